@@ -0,0 +1,316 @@
+#include "BlockCache.h"
+#include "FloatCodec.h"
+#include "LargeAlloc.h"
+#include "dem.h"
+#include <string.h>
+#include <algorithm>
+
+static const size_t BLOCK_CELLS = (size_t)DEM_BLOCK_SIZE * DEM_BLOCK_SIZE;
+static const size_t BLOCK_BYTES = BLOCK_CELLS * sizeof(float);
+static const size_t FLAG_PAGE_BYTES = (size_t)FLAG_BLOCK_SIZE * FLAG_BLOCK_SIZE / 8;
+
+PageCache::PageCache()
+{
+	pageBytes = 0;
+	slotData = NULL;
+	lruHead = lruTail = -1;
+	accesses = misses = writeBacks = 0;
+	ioError = false;
+}
+
+PageCache::~PageCache()
+{
+	FreeLarge(slotData);
+}
+
+bool PageCache::InitPages(int pageCount, size_t pageBytes, int cacheSlots)
+{
+	if (cacheSlots > pageCount) cacheSlots = pageCount;
+	if (cacheSlots < 1) cacheSlots = 1;
+	FreeLarge(slotData);
+	slotData = (unsigned char*)AllocLarge((size_t)cacheSlots * pageBytes);
+	if (slotData == NULL)
+	{
+		slots.clear();
+		return false;
+	}
+	this->pageBytes = pageBytes;
+	slotOfPage.assign(pageCount, -1);
+	slots.resize(cacheSlots);
+	for (int i = 0; i < cacheSlots; i++)
+	{
+		slots[i].page = -1;
+		slots[i].dirty = false;
+		slots[i].prev = i - 1;
+		slots[i].next = i + 1 < cacheSlots ? i + 1 : -1;
+		slots[i].data = slotData + (size_t)i * pageBytes;
+	}
+	lruHead = 0;
+	lruTail = cacheSlots - 1;
+	ioError = false;
+	ResetCounters();
+	return true;
+}
+
+//unlink a slot and put it at the front of the LRU list
+void PageCache::MoveToFront(int slot)
+{
+	Slot& s = slots[slot];
+	if (s.prev >= 0) slots[s.prev].next = s.next;
+	if (s.next >= 0) slots[s.next].prev = s.prev;
+	else lruTail = s.prev;
+	s.prev = -1;
+	s.next = lruHead;
+	slots[lruHead].prev = slot;
+	lruHead = slot;
+}
+
+//bring a page into the least recently used slot and return the slot
+int PageCache::Load(int page)
+{
+	misses++;
+	int victim = lruTail;
+	if (victim != lruHead) MoveToFront(victim);
+	Slot& slot = slots[victim];
+	if (slot.page >= 0)
+	{
+		if (slot.dirty)
+		{
+			if (!StorePage(slot.page, slot.data))
+			{
+				if (!ioError) printf("Failed to write block %d back to the block store\n", slot.page);
+				ioError = true;
+			}
+			writeBacks++;
+		}
+		slotOfPage[slot.page] = -1;
+	}
+	if (!LoadPage(page, slot.data))
+	{
+		if (!ioError) printf("Failed to load block %d from the block store\n", page);
+		ioError = true;
+	}
+	slot.page = page;
+	slot.dirty = false;
+	slotOfPage[page] = victim;
+	return victim;
+}
+
+bool PageCache::Flush()
+{
+	bool ok = true;
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		if (slots[i].page >= 0 && slots[i].dirty)
+		{
+			ok = StorePage(slots[i].page, slots[i].data) && ok;
+			slots[i].dirty = false;
+			writeBacks++;
+		}
+	}
+	if (!ok) ioError = true;
+	return ok;
+}
+
+void PageCache::ResetCounters()
+{
+	accesses = misses = writeBacks = 0;
+}
+
+BlockCache::BlockCache()
+{
+	width = 0;
+	height = 0;
+	blocksPerRow = 0;
+	blocksPerCol = 0;
+}
+
+int BlockCache::DefaultCacheBlocks(int width, int height)
+{
+	int blocksPerRow = (width + DEM_BLOCK_SIZE - 1) >> DEM_BLOCK_SHIFT;
+	int blocksPerCol = (height + DEM_BLOCK_SIZE - 1) >> DEM_BLOCK_SHIFT;
+	return 2 * (blocksPerRow + blocksPerCol) + 16;
+}
+
+bool BlockCache::Init(int width, int height, int cacheBlocks)
+{
+	this->width = width;
+	this->height = height;
+	blocksPerRow = (width + DEM_BLOCK_SIZE - 1) >> DEM_BLOCK_SHIFT;
+	blocksPerCol = (height + DEM_BLOCK_SIZE - 1) >> DEM_BLOCK_SHIFT;
+	if (cacheBlocks <= 0) cacheBlocks = DefaultCacheBlocks(width, height);
+	return InitPages(blocksPerRow * blocksPerCol, BLOCK_BYTES, cacheBlocks);
+}
+
+void BlockCache::GetRows(int firstRow, int rowCount, float* rows)
+{
+	for (int col = 0; col < width; col += DEM_BLOCK_SIZE)
+	{
+		int n = std::min(DEM_BLOCK_SIZE, width - col);
+		for (int r = 0; r < rowCount; r++)
+		{
+			int row = firstRow + r;
+			const float* data = (const float*)Page(BlockOf(row, col), false);
+			memcpy(rows + (size_t)r * width + col, data + OffsetOf(row, 0), n * sizeof(float));
+		}
+	}
+}
+
+void BlockCache::SetRows(int firstRow, int rowCount, const float* rows)
+{
+	for (int col = 0; col < width; col += DEM_BLOCK_SIZE)
+	{
+		int n = std::min(DEM_BLOCK_SIZE, width - col);
+		for (int r = 0; r < rowCount; r++)
+		{
+			int row = firstRow + r;
+			float* data = (float*)Page(BlockOf(row, col), true);
+			memcpy(data + OffsetOf(row, 0), rows + (size_t)r * width + col, n * sizeof(float));
+		}
+	}
+}
+
+static void FillNoData(unsigned char* data)
+{
+	float* values = (float*)data;
+	for (size_t i = 0; i < BLOCK_CELLS; i++) values[i] = NO_DATA_VALUE;
+}
+
+bool CompressedBlockStore::Init(int width, int height, int cacheBlocks)
+{
+	if (!BlockCache::Init(width, height, cacheBlocks)) return false;
+	blocks.clear();
+	blocks.resize((size_t)blocksPerRow * blocksPerCol);
+	return true;
+}
+
+bool CompressedBlockStore::LoadPage(int page, unsigned char* data)
+{
+	const std::vector<unsigned char>& packed = blocks[page];
+	if (packed.empty())
+	{
+		FillNoData(data);
+		return true;
+	}
+	return FloatCodec::Decompress(&packed[0], packed.size(), DEM_BLOCK_SIZE, DEM_BLOCK_SIZE, (float*)data);
+}
+
+bool CompressedBlockStore::StorePage(int page, const unsigned char* data)
+{
+	std::vector<unsigned char> packed;
+	FloatCodec::Compress((const float*)data, DEM_BLOCK_SIZE, DEM_BLOCK_SIZE, packed);
+	//swap so the block holds exactly its compressed size
+	blocks[page].swap(packed);
+	return true;
+}
+
+size_t CompressedBlockStore::CompressedBytes() const
+{
+	size_t bytes = 0;
+	for (size_t i = 0; i < blocks.size(); i++) bytes += blocks[i].capacity();
+	return bytes;
+}
+
+#ifdef _WIN32
+#define fseek64 _fseeki64
+#else
+#define fseek64 fseeko
+#endif
+
+ScratchFile::ScratchFile()
+{
+	fp = NULL;
+}
+
+ScratchFile::~ScratchFile()
+{
+	Close();
+}
+
+bool ScratchFile::Open(const std::string& path)
+{
+	Close();
+	this->path = path;
+	fp = path.empty() ? tmpfile() : fopen(path.c_str(), "w+b");
+	return fp != NULL;
+}
+
+//a named scratch file is deleted once it is no longer needed
+void ScratchFile::Close()
+{
+	if (fp == NULL) return;
+	fclose(fp);
+	fp = NULL;
+	if (!path.empty()) remove(path.c_str());
+}
+
+bool ScratchFile::Read(unsigned long long offset, void* data, size_t bytes)
+{
+	if (fp == NULL || fseek64(fp, offset, SEEK_SET) != 0) return false;
+	return fread(data, 1, bytes, fp) == bytes;
+}
+
+bool ScratchFile::Write(unsigned long long offset, const void* data, size_t bytes)
+{
+	if (fp == NULL || fseek64(fp, offset, SEEK_SET) != 0) return false;
+	return fwrite(data, 1, bytes, fp) == bytes;
+}
+
+bool PagedBlockStore::Init(int width, int height, int cacheBlocks, const std::string& scratchPath)
+{
+	if (!BlockCache::Init(width, height, cacheBlocks)) return false;
+	stored.assign((size_t)blocksPerRow * blocksPerCol, false);
+	return file.Open(scratchPath);
+}
+
+bool PagedBlockStore::LoadPage(int page, unsigned char* data)
+{
+	if (!stored[page])
+	{
+		FillNoData(data);
+		return true;
+	}
+	return file.Read((unsigned long long)page * BLOCK_BYTES, data, BLOCK_BYTES);
+}
+
+bool PagedBlockStore::StorePage(int page, const unsigned char* data)
+{
+	stored[page] = true;
+	return file.Write((unsigned long long)page * BLOCK_BYTES, data, BLOCK_BYTES);
+}
+
+PagedBitGrid::PagedBitGrid()
+{
+	width = 0;
+	height = 0;
+	blocksPerRow = 0;
+	blocksPerCol = 0;
+}
+
+bool PagedBitGrid::Init(int width, int height, int cacheBlocks, const std::string& scratchPath)
+{
+	this->width = width;
+	this->height = height;
+	blocksPerRow = (width + FLAG_BLOCK_SIZE - 1) >> FLAG_BLOCK_SHIFT;
+	blocksPerCol = (height + FLAG_BLOCK_SIZE - 1) >> FLAG_BLOCK_SHIFT;
+	if (cacheBlocks <= 0) cacheBlocks = 2 * (blocksPerRow + blocksPerCol) + 16;
+	if (!InitPages(blocksPerRow * blocksPerCol, FLAG_PAGE_BYTES, cacheBlocks)) return false;
+	stored.assign((size_t)blocksPerRow * blocksPerCol, false);
+	return file.Open(scratchPath);
+}
+
+bool PagedBitGrid::LoadPage(int page, unsigned char* data)
+{
+	if (!stored[page])
+	{
+		memset(data, 0, FLAG_PAGE_BYTES);
+		return true;
+	}
+	return file.Read((unsigned long long)page * FLAG_PAGE_BYTES, data, FLAG_PAGE_BYTES);
+}
+
+bool PagedBitGrid::StorePage(int page, const unsigned char* data)
+{
+	stored[page] = true;
+	return file.Write((unsigned long long)page * FLAG_PAGE_BYTES, data, FLAG_PAGE_BYTES);
+}
@@ -0,0 +1,200 @@
+#ifndef BLOCK_CACHE_HEAD_H
+#define BLOCK_CACHE_HEAD_H
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stddef.h>
+
+//blocks of DEM_BLOCK_SIZE x DEM_BLOCK_SIZE cells (64 KiB of floats)
+#define DEM_BLOCK_SHIFT 7
+#define DEM_BLOCK_SIZE (1 << DEM_BLOCK_SHIFT)
+//Flag pages of FLAG_BLOCK_SIZE x FLAG_BLOCK_SIZE bits (32 KiB)
+#define FLAG_BLOCK_SHIFT 9
+#define FLAG_BLOCK_SIZE (1 << FLAG_BLOCK_SHIFT)
+
+/*
+*	LRU cache of fixed-size pages in front of a page store. A page -> slot
+*	table makes a hit one table load; the slots sit on an intrusive list from
+*	the most to the least recently used, so a hit relinks its slot at the
+*	front and a miss evicts the slot at the back, writing it back first if
+*	it was modified. Subclasses provide the store (LoadPage / StorePage) and
+*	the addressing.
+*/
+class PageCache
+{
+protected:
+	struct Slot
+	{
+		int page;
+		bool dirty;
+		//neighbours on the LRU list, -1 at its ends
+		int prev, next;
+		unsigned char* data;
+	};
+	size_t pageBytes;
+	std::vector<int> slotOfPage;
+	std::vector<Slot> slots;
+	unsigned char* slotData;
+	//most and least recently used slots
+	int lruHead, lruTail;
+	long long accesses, misses, writeBacks;
+	bool ioError;
+
+	int Load(int page);
+	void MoveToFront(int slot);
+	//a page that was never stored must be filled with its initial value
+	virtual bool LoadPage(int page, unsigned char* data) = 0;
+	virtual bool StorePage(int page, const unsigned char* data) = 0;
+	bool InitPages(int pageCount, size_t pageBytes, int cacheSlots);
+	inline unsigned char* Page(int page, bool write)
+	{
+		accesses++;
+		int slot = slotOfPage[page];
+		if (slot < 0) slot = Load(page);
+		else if (slot != lruHead) MoveToFront(slot);
+		if (write) slots[slot].dirty = true;
+		return slots[slot].data;
+	}
+public:
+	PageCache();
+	virtual ~PageCache();
+	//write every dirty page back to the store
+	bool Flush();
+	long long GetHits() const { return accesses - misses; }
+	long long GetMisses() const { return misses; }
+	long long GetWriteBacks() const { return writeBacks; }
+	void ResetCounters();
+	//true once a page could not be read or written; the cached data is wrong
+	//from then on
+	bool Failed() const { return ioError; }
+	size_t CacheBytes() const { return slots.size() * pageBytes; }
+	int CacheSlots() const { return (int)slots.size(); }
+};
+
+/*
+*	Float DEM in DEM_BLOCK_SIZE x DEM_BLOCK_SIZE blocks, one block per page.
+*	Edge blocks are padded to the full size; blocks never stored read back
+*	as NO_DATA_VALUE.
+*/
+class BlockCache : public PageCache
+{
+protected:
+	int width, height;
+	int blocksPerRow, blocksPerCol;
+	inline int BlockOf(int row, int col) const
+	{
+		return (row >> DEM_BLOCK_SHIFT) * blocksPerRow + (col >> DEM_BLOCK_SHIFT);
+	}
+	inline static int OffsetOf(int row, int col)
+	{
+		return ((row & (DEM_BLOCK_SIZE - 1)) << DEM_BLOCK_SHIFT) + (col & (DEM_BLOCK_SIZE - 1));
+	}
+public:
+	BlockCache();
+	//cacheBlocks = 0 keeps twice the DEM perimeter in blocks, enough for
+	//the flooding front and for row-by-row scans
+	bool Init(int width, int height, int cacheBlocks);
+	static int DefaultCacheBlocks(int width, int height);
+	int Get_NX() const { return width; }
+	int Get_NY() const { return height; }
+	inline float Get(int row, int col)
+	{
+		return ((const float*)Page(BlockOf(row, col), false))[OffsetOf(row, col)];
+	}
+	inline void Set(int row, int col, float z)
+	{
+		((float*)Page(BlockOf(row, col), true))[OffsetOf(row, col)] = z;
+	}
+	//copy whole rows in and out, one block at a time
+	void GetRows(int firstRow, int rowCount, float* rows);
+	void SetRows(int firstRow, int rowCount, const float* rows);
+};
+
+/*
+*	Block store that keeps every block compressed with FloatCodec; only the
+*	cached blocks are held as raw floats.
+*/
+class CompressedBlockStore : public BlockCache
+{
+private:
+	std::vector<std::vector<unsigned char> > blocks;
+protected:
+	virtual bool LoadPage(int page, unsigned char* data);
+	virtual bool StorePage(int page, const unsigned char* data);
+public:
+	bool Init(int width, int height, int cacheBlocks);
+	//bytes held by the compressed blocks (the cache comes on top)
+	size_t CompressedBytes() const;
+	//FloatCodec data of a block as last stored, empty if it never was;
+	//Flush first to include the cached changes
+	const std::vector<unsigned char>& GetPackedBlock(int block) const { return blocks[block]; }
+};
+
+//fixed-size records in a scratch file; an empty path uses tmpfile()
+class ScratchFile
+{
+private:
+	FILE* fp;
+	std::string path;
+public:
+	ScratchFile();
+	~ScratchFile();
+	bool Open(const std::string& path);
+	void Close();
+	bool Read(unsigned long long offset, void* data, size_t bytes);
+	bool Write(unsigned long long offset, const void* data, size_t bytes);
+};
+
+//out-of-core DEM: raw float blocks in a scratch file
+class PagedBlockStore : public BlockCache
+{
+private:
+	ScratchFile file;
+	std::vector<bool> stored;
+protected:
+	virtual bool LoadPage(int page, unsigned char* data);
+	virtual bool StorePage(int page, const unsigned char* data);
+public:
+	bool Init(int width, int height, int cacheBlocks, const std::string& scratchPath);
+};
+
+/*
+*	Out-of-core bit grid for Flag, FLAG_BLOCK_SIZE x FLAG_BLOCK_SIZE bits per
+*	page in a scratch file. Pages never stored read back as zero.
+*/
+class PagedBitGrid : public PageCache
+{
+private:
+	int width, height;
+	int blocksPerRow, blocksPerCol;
+	ScratchFile file;
+	std::vector<bool> stored;
+	inline int BlockOf(int row, int col) const
+	{
+		return (row >> FLAG_BLOCK_SHIFT) * blocksPerRow + (col >> FLAG_BLOCK_SHIFT);
+	}
+	inline static int BitOf(int row, int col)
+	{
+		return ((row & (FLAG_BLOCK_SIZE - 1)) << FLAG_BLOCK_SHIFT) + (col & (FLAG_BLOCK_SIZE - 1));
+	}
+protected:
+	virtual bool LoadPage(int page, unsigned char* data);
+	virtual bool StorePage(int page, const unsigned char* data);
+public:
+	PagedBitGrid();
+	//cacheBlocks = 0 keeps twice the grid perimeter in pages
+	bool Init(int width, int height, int cacheBlocks, const std::string& scratchPath);
+	inline bool Test(int row, int col)
+	{
+		int bit = BitOf(row, col);
+		return (Page(BlockOf(row, col), false)[bit >> 3] >> (bit & 7)) & 1;
+	}
+	inline void Set(int row, int col)
+	{
+		int bit = BitOf(row, col);
+		Page(BlockOf(row, col), true)[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+	}
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "Checkpoint.h"
+#include "FloatCodec.h"
+#include "BlockCache.h"
+#include "PhaseTrace.h"
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static const char CHECKPOINT_MAGIC[8] = { 'F', 'I', 'L', 'L', 'C', 'K', 'P', '2' };
+//cells per compressed strip
+static const size_t CHECKPOINT_STRIP_CELLS = 1 << 20;
+
+//replaces to with from, keeping to if the rename fails
+static bool ReplaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+Checkpointer::Checkpointer()
+{
+	interval = CHECKPOINT_DEFAULT_INTERVAL;
+	nextCheck = LLONG_MAX;
+	memset(&header, 0, sizeof(header));
+	writing = false;
+	written = true;
+	resuming = false;
+}
+
+Checkpointer::~Checkpointer()
+{
+	Wait();
+}
+
+void Checkpointer::SetPath(const std::string& path)
+{
+	this->path = path;
+}
+
+void Checkpointer::SetInterval(double seconds)
+{
+	interval = seconds;
+}
+
+void Checkpointer::Start(const char* engine, int connectivity, const double* geoTransform, long long total, long long done)
+{
+	memset(header.engine, 0, sizeof(header.engine));
+	strncpy(header.engine, engine, sizeof(header.engine) - 1);
+	header.connectivity = connectivity;
+	memcpy(header.geoTransform, geoTransform, sizeof(header.geoTransform));
+	header.total = total;
+	nextSave = std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+	nextCheck = Enabled() ? done + CHECKPOINT_CHECK_CELLS : LLONG_MAX;
+}
+
+//slow path of Due()
+bool Checkpointer::CheckClock(long long done)
+{
+	nextCheck = done + CHECKPOINT_CHECK_CELLS;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now < nextSave) return false;
+	nextSave = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+	return true;
+}
+
+bool Checkpointer::Ready()
+{
+	if (writing.load()) return false;
+	if (writer.joinable()) writer.join();
+	return true;
+}
+
+//DEM pieces of the snapshot: blocks or strips
+size_t Checkpointer::PieceCount() const
+{
+	if (header.blockLayout)
+	{
+		size_t blocksPerRow = (header.width + DEM_BLOCK_SIZE - 1) >> DEM_BLOCK_SHIFT;
+		size_t blocksPerCol = (header.height + DEM_BLOCK_SIZE - 1) >> DEM_BLOCK_SHIFT;
+		return blocksPerRow * blocksPerCol;
+	}
+	return (header.height + header.stripRows - 1) / header.stripRows;
+}
+
+bool Checkpointer::Save(long long done, const CDEM& dem, Flag& flag)
+{
+	if (!Enabled() || !Ready()) return false;
+	PhaseSpan span("checkpoint copy");
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.width = width;
+	header.height = height;
+	header.done = done;
+	for (int q = 0; q < CHECKPOINT_QUEUES; q++) header.queueSizes[q] = queues[q].size();
+
+	//the DEM is never copied raw: compressed blocks are taken as they are,
+	//anything else is compressed a strip at a time
+	CompressedBlockStore* store = dem.GetStorage() == DEM_STORAGE_COMPRESSED ? (CompressedBlockStore*)dem.GetBlocks() : NULL;
+	header.blockLayout = store != NULL;
+	header.stripRows = store != NULL ? DEM_BLOCK_SIZE : (int)std::max((size_t)1, CHECKPOINT_STRIP_CELLS / width);
+	pieces.resize(PieceCount());
+	if (store != NULL)
+	{
+		store->Flush();
+		for (size_t i = 0; i < pieces.size(); i++) pieces[i] = store->GetPackedBlock((int)i);
+	}
+	else
+	{
+		std::vector<float> strip((size_t)header.stripRows * width);
+		for (size_t s = 0; s < pieces.size(); s++)
+		{
+			int row = (int)s * header.stripRows;
+			int rowCount = std::min(header.stripRows, height - row);
+			dem.GetRows(row, rowCount, &strip[0]);
+			FloatCodec::Compress(&strip[0], rowCount, width, pieces[s]);
+		}
+	}
+	size_t cells = (size_t)width * height;
+	flagBits.resize((cells + 7) / 8);
+#ifndef DEM_TILED_LAYOUT
+	if (flag.pager == NULL) memcpy(&flagBits[0], flag.flagArray, flagBits.size());
+	else
+#endif
+	{
+		std::fill(flagBits.begin(), flagBits.end(), (unsigned char)0);
+		for (int row = 0; row < height; row++)
+		{
+			for (int col = 0; col < width; col++)
+			{
+				if (!flag.IsProcessedDirect(row, col)) continue;
+				size_t index = (size_t)row * width + col;
+				flagBits[index / 8] |= value[index % 8];
+			}
+		}
+	}
+	span.End();
+
+	writing = true;
+	writer = std::thread(&Checkpointer::Write, this);
+	return true;
+}
+
+//the writer thread: writes the copy and replaces the snapshot
+void Checkpointer::Write()
+{
+	PhaseSpan span("checkpoint write");
+	std::string tmpPath = path + ".tmp";
+	FILE* fp = fopen(tmpPath.c_str(), "wb");
+	bool ok = fp != NULL && fwrite(&header, sizeof(header), 1, fp) == 1;
+	for (size_t i = 0; ok && i < pieces.size(); i++)
+	{
+		unsigned long long bytes = pieces[i].size();
+		ok = fwrite(&bytes, sizeof(bytes), 1, fp) == 1 && fwrite(pieces[i].data(), 1, pieces[i].size(), fp) == pieces[i].size();
+	}
+	ok = ok && fwrite(&flagBits[0], 1, flagBits.size(), fp) == flagBits.size();
+	for (int q = 0; ok && q < CHECKPOINT_QUEUES; q++)
+	{
+		if (!queues[q].empty()) ok = fwrite(&queues[q][0], sizeof(Node), queues[q].size(), fp) == queues[q].size();
+	}
+	if (fp != NULL && fclose(fp) != 0) ok = false;
+	if (ok) ok = ReplaceFile(tmpPath, path);
+	if (!ok)
+	{
+		printf("Failed to write the checkpoint %s\n", path.c_str());
+		remove(tmpPath.c_str());
+	}
+	written = ok;
+	writing = false;
+}
+
+bool Checkpointer::Wait()
+{
+	if (writer.joinable()) writer.join();
+	return written;
+}
+
+void Checkpointer::Finish(bool completed)
+{
+	Wait();
+	nextCheck = LLONG_MAX;
+	pieces = std::vector<std::vector<unsigned char> >();
+	flagBits = std::vector<unsigned char, LargeAllocator<unsigned char> >();
+	for (int q = 0; q < CHECKPOINT_QUEUES; q++) queues[q] = std::vector<Node>();
+	if (completed && Enabled()) remove(path.c_str());
+}
+
+bool Checkpointer::Open(const char* path)
+{
+	Wait();
+	resuming = false;
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		printf("Cannot open the checkpoint %s\n", path);
+		return false;
+	}
+	bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+		memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 &&
+		header.width > 0 && header.height > 0 && header.stripRows > 0;
+	header.engine[sizeof(header.engine) - 1] = '\0';
+	pieces.clear();
+	if (ok) pieces.resize(PieceCount());
+	for (size_t i = 0; ok && i < pieces.size(); i++)
+	{
+		unsigned long long bytes = 0;
+		ok = fread(&bytes, sizeof(bytes), 1, fp) == 1;
+		if (!ok) break;
+		pieces[i].resize((size_t)bytes);
+		if (bytes > 0) ok = fread(pieces[i].data(), 1, (size_t)bytes, fp) == bytes;
+	}
+	if (ok)
+	{
+		flagBits.resize(((size_t)header.width * header.height + 7) / 8);
+		ok = fread(&flagBits[0], 1, flagBits.size(), fp) == flagBits.size();
+	}
+	for (int q = 0; ok && q < CHECKPOINT_QUEUES; q++)
+	{
+		queues[q].resize((size_t)header.queueSizes[q]);
+		if (!queues[q].empty()) ok = fread(&queues[q][0], sizeof(Node), queues[q].size(), fp) == queues[q].size();
+	}
+	fclose(fp);
+	if (!ok)
+	{
+		printf("The checkpoint %s is damaged\n", path);
+		pieces.clear();
+		return false;
+	}
+	resuming = true;
+	return true;
+}
+
+bool Checkpointer::LoadDEM(CDEM& dem, double* geoTransform)
+{
+	PhaseSpan span("checkpoint load");
+	dem.SetWidth(header.width);
+	dem.SetHeight(header.height);
+	if (!dem.Allocate(false)) return false;
+	int width = header.width;
+	std::vector<float> strip((size_t)header.stripRows * width);
+	std::vector<float> block(header.blockLayout ? (size_t)DEM_BLOCK_SIZE * DEM_BLOCK_SIZE : 0);
+	int blocksPerRow = (width + DEM_BLOCK_SIZE - 1) >> DEM_BLOCK_SHIFT;
+	bool ok = true;
+	for (int row = 0; ok && row < header.height; row += header.stripRows)
+	{
+		int rowCount = std::min(header.stripRows, header.height - row);
+		if (!header.blockLayout)
+		{
+			const std::vector<unsigned char>& packed = pieces[row / header.stripRows];
+			ok = FloatCodec::Decompress(packed.data(), packed.size(), rowCount, width, &strip[0]);
+		}
+		//a strip is one row of blocks; copy the cells inside the DEM out of each
+		for (int b = 0; ok && header.blockLayout && b < blocksPerRow; b++)
+		{
+			const std::vector<unsigned char>& packed = pieces[(size_t)(row >> DEM_BLOCK_SHIFT) * blocksPerRow + b];
+			if (packed.empty()) std::fill(block.begin(), block.end(), NO_DATA_VALUE);
+			else ok = FloatCodec::Decompress(packed.data(), packed.size(), DEM_BLOCK_SIZE, DEM_BLOCK_SIZE, &block[0]);
+			int col = b << DEM_BLOCK_SHIFT;
+			int cols = std::min(DEM_BLOCK_SIZE, width - col);
+			for (int r = 0; ok && r < rowCount; r++)
+				memcpy(&strip[(size_t)r * width + col], &block[(size_t)r * DEM_BLOCK_SIZE], cols * sizeof(float));
+		}
+		if (ok) dem.SetRows(row, rowCount, &strip[0]);
+	}
+	pieces = std::vector<std::vector<unsigned char> >();
+	if (!ok)
+	{
+		printf("The checkpoint is damaged\n");
+		return false;
+	}
+	memcpy(geoTransform, header.geoTransform, sizeof(header.geoTransform));
+	return dem.BuildValidMask();
+}
+
+void Checkpointer::LoadFlags(Flag& flag)
+{
+	int width = header.width;
+	int height = header.height;
+#ifndef DEM_TILED_LAYOUT
+	if (flag.pager == NULL) memcpy(flag.flagArray, &flagBits[0], flagBits.size());
+	else
+#endif
+	{
+		for (int row = 0; row < height; row++)
+		{
+			for (int col = 0; col < width; col++)
+			{
+				size_t index = (size_t)row * width + col;
+				if (flagBits[index / 8] & value[index % 8]) flag.SetFlag(row, col);
+			}
+		}
+	}
+	flagBits = std::vector<unsigned char, LargeAllocator<unsigned char> >();
+	resuming = false;
+}
@@ -0,0 +1,120 @@
+#ifndef CHECKPOINT_HEAD_H
+#define CHECKPOINT_HEAD_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "LargeAlloc.h"
+
+/*
+*	Periodic snapshots of a long fill, and resuming from them. An engine
+*	polls Due() in its outer loop, where its trace queues are empty, and
+*	calls FillWorkspace::SaveCheckpoint when it returns true. Save
+*	compresses the DEM with FloatCodec a strip at a time through a small
+*	buffer (compressed storage hands over its blocks as they are), copies
+*	the Flag bits and the queued nodes and returns; a background thread
+*	writes the snapshot to path + ".tmp", then renames it over path, so a
+*	crash while writing keeps the previous snapshot. A snapshot that comes due while the
+*	last one is still being written is skipped. FillDEM_Resume opens a
+*	snapshot and runs the engine that wrote it from there.
+*/
+
+//snapshots every 10 minutes by default
+#define CHECKPOINT_DEFAULT_INTERVAL 600.0
+//cells between two looks at the clock
+#define CHECKPOINT_CHECK_CELLS (1 << 20)
+
+//the queues a snapshot holds
+enum CheckpointQueue
+{
+	CHECKPOINT_PRIORITY_QUEUE = 0,
+	CHECKPOINT_DEPRESSION_QUEUE,
+	CHECKPOINT_TRACE_QUEUE,
+	CHECKPOINT_QUEUES
+};
+
+//start of a snapshot file; the DEM pieces, the flag bits (one per cell,
+//row-major) and the nodes of each queue follow. Each piece is its byte
+//count and FloatCodec data: a strip of stripRows rows, or with blockLayout
+//a DEM_BLOCK_SIZE block in row-major block order (no bytes: all NoData).
+struct CheckpointHeader
+{
+	char magic[8];
+	char engine[24];
+	int connectivity;
+	int width, height;
+	int stripRows;
+	int blockLayout;
+	double geoTransform[6];
+	//cells processed, and the engine's progress total
+	long long done;
+	long long total;
+	unsigned long long queueSizes[CHECKPOINT_QUEUES];
+};
+
+class Checkpointer
+{
+public:
+	//nodes of each queue: filled before Save, and by Open for the resume
+	std::vector<Node> queues[CHECKPOINT_QUEUES];
+private:
+	std::string path;
+	double interval;
+	long long nextCheck;
+	std::chrono::steady_clock::time_point nextSave;
+	CheckpointHeader header;
+	//the compressed DEM pieces Save made or Open read, and the flags
+	std::vector<std::vector<unsigned char> > pieces;
+	std::vector<unsigned char, LargeAllocator<unsigned char> > flagBits;
+	std::thread writer;
+	std::atomic<bool> writing;
+	bool written;
+	bool resuming;
+
+	bool CheckClock(long long done);
+	void Write();
+	size_t PieceCount() const;
+public:
+	Checkpointer();
+	~Checkpointer();
+	//empty (the default) takes no snapshots
+	void SetPath(const std::string& path);
+	const std::string& GetPath() const { return path; }
+	void SetInterval(double seconds);
+	bool Enabled() const { return !path.empty(); }
+
+	//before the engine's loop: what every snapshot records about the fill;
+	//done is where the loop starts
+	void Start(const char* engine, int connectivity, const double* geoTransform, long long total, long long done);
+	//a compare until the next look at the clock, like ProgressSink::Poll
+	inline bool Due(long long done)
+	{
+		return done >= nextCheck && CheckClock(done);
+	}
+	//false while the last snapshot is still being written
+	bool Ready();
+	//compresses the DEM, copies flag and starts writing them with queues;
+	//false if nothing was started
+	bool Save(long long done, const CDEM& dem, Flag& flag);
+	//waits for the writer; false if the last snapshot failed
+	bool Wait();
+	//once the fill is over; a completed fill needs its snapshot no more
+	void Finish(bool completed);
+
+	//reads a snapshot for FillDEM_Resume; the engine then finds Resuming()
+	//set, and takes the DEM, the flags and the queues from here
+	bool Open(const char* path);
+	bool Resuming() const { return resuming; }
+	const CheckpointHeader& GetHeader() const { return header; }
+	//allocates dem in its current storage and decompresses the DEM into it
+	bool LoadDEM(CDEM& dem, double* geoTransform);
+	//after FillWorkspace::Prepare: the flags; ends the resume
+	void LoadFlags(Flag& flag);
+};
+
+#endif
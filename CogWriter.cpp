@@ -0,0 +1,177 @@
+#include "CogWriter.h"
+#include "gdal_priv.h"
+#include "cpl_string.h"
+#include "dem.h"
+#include "PhaseTrace.h"
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+//rows [firstRow, lastRow) of the next level: the mean of the valid cells of
+//each 2 x 2 block (1 x 2, 2 x 1 or 1 x 1 on odd edges), NoData if none is valid
+static void HalveRows(const float* src, int width, int height, float* dst, int firstRow, int lastRow)
+{
+	PhaseSpan span("overview rows");
+	int dstWidth = (width + 1) / 2;
+	for (int row = firstRow; row < lastRow; row++)
+	{
+		int r0 = 2 * row;
+		int r1 = std::min(r0 + 1, height - 1);
+		const float* line0 = src + (size_t)r0 * width;
+		const float* line1 = src + (size_t)r1 * width;
+		float* out = dst + (size_t)row * dstWidth;
+		for (int col = 0; col < dstWidth; col++)
+		{
+			int c0 = 2 * col;
+			int c1 = std::min(c0 + 1, width - 1);
+			//on odd edges c1 == c0 or r1 == r0; count such cells once
+			double sum = 0;
+			int valid = 0;
+			for (int r = r0; r <= r1; r++)
+			{
+				const float* line = r == r0 ? line0 : line1;
+				for (int c = c0; c <= c1; c++)
+				{
+					if (line[c] == NO_DATA_VALUE) continue;
+					sum += line[c];
+					valid++;
+				}
+			}
+			out[col] = valid > 0 ? (float)(sum / valid) : NO_DATA_VALUE;
+		}
+	}
+}
+
+//next pyramid level, the rows split into one contiguous band per thread
+static void HalveLevel(const float* src, int width, int height, std::vector<float>& dst, int threads)
+{
+	int dstWidth = (width + 1) / 2;
+	int dstHeight = (height + 1) / 2;
+	dst.resize((size_t)dstWidth * dstHeight);
+	threads = std::max(1, std::min(threads, dstHeight / 16));
+	std::vector<std::thread> pool;
+	for (int t = 1; t < threads; t++)
+	{
+		pool.push_back(std::thread(HalveRows, src, width, height, &dst[0],
+			(int)((long long)dstHeight * t / threads), (int)((long long)dstHeight * (t + 1) / threads)));
+	}
+	HalveRows(src, width, height, &dst[0], 0, (int)((long long)dstHeight / threads));
+	for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+}
+
+bool CreateCOG(const char* path, const CDEM& dem, double* geoTransformArray6Eles,
+	double* min, double* max, double* mean, double* stdDev, double nodatavalue, const CogOptions& options)
+{
+	PhaseSpan span("write");
+	GDALAllRegister();
+	CPLSetConfigOption("GDAL_FILENAME_IS_UTF8", "NO");
+	GDALDriver* poCogDriver = GetGDALDriverManager()->GetDriverByName("COG");
+	GDALDriver* poMemDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+	if (poCogDriver == NULL || poMemDriver == NULL)
+	{
+		printf("GDAL has no COG driver (GDAL 3.1 or later is needed)\n");
+		return false;
+	}
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	int threads = options.threads > 0 ? options.threads : std::max(1, (int)std::thread::hardware_concurrency());
+
+	//full resolution: the DEM buffer itself when it is row-major, else a
+	//row-major copy gathered strip by strip
+	std::vector<float> copy;
+	const float* full = dem.getDEMdata();
+	if (!dem.IsRowMajor())
+	{
+		copy.resize((size_t)width * height);
+		for (int row = 0; row < height; row += dem.StripRows())
+		{
+			int rowCount = std::min(dem.StripRows(), height - row);
+			dem.GetRows(row, rowCount, &copy[(size_t)row * width]);
+		}
+		full = &copy[0];
+	}
+
+	//a MEM dataset on top of the buffer, no copy
+	GDALDataset* poMem = poMemDriver->Create("", width, height, 0, GDT_Float32, NULL);
+	if (poMem == NULL) return false;
+	char pointer[64];
+	int length = CPLPrintPointer(pointer, (void*)full, sizeof(pointer) - 1);
+	pointer[length] = '\0';
+	char** papszBandOptions = CSLSetNameValue(NULL, "DATAPOINTER", pointer);
+	CPLErr err = poMem->AddBand(GDT_Float32, papszBandOptions);
+	CSLDestroy(papszBandOptions);
+	if (err != CE_None)
+	{
+		GDALClose((GDALDatasetH)poMem);
+		return false;
+	}
+	if (geoTransformArray6Eles != NULL)
+		poMem->SetGeoTransform(geoTransformArray6Eles);
+	GDALRasterBand* poBand = poMem->GetRasterBand(1);
+	poBand->SetNoDataValue(nodatavalue);
+	if (min != NULL && max != NULL && mean != NULL && stdDev != NULL)
+	{
+		poBand->SetStatistics(*min, *max, *mean, *stdDev);
+	}
+
+	//halve until a level fits in one tile, as the COG driver would
+	std::vector<int> factors;
+	for (int w = width, h = height, f = 2; w > options.blockSize || h > options.blockSize; f *= 2)
+	{
+		factors.push_back(f);
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+	if (!factors.empty())
+	{
+		//"NONE" only creates the overview bands, they are filled below
+		err = poMem->BuildOverviews("NONE", (int)factors.size(), &factors[0], 0, NULL, NULL, NULL);
+		if (err != CE_None || poBand->GetOverviewCount() != (int)factors.size())
+		{
+			printf("Failed to create the overviews\n");
+			GDALClose((GDALDatasetH)poMem);
+			return false;
+		}
+		PhaseSpan pyramidSpan("overviews");
+		std::vector<float> level, next;
+		const float* src = full;
+		int w = width, h = height;
+		for (size_t i = 0; i < factors.size() && err == CE_None; i++)
+		{
+			HalveLevel(src, w, h, next, threads);
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+			GDALRasterBand* poOverview = poBand->GetOverview((int)i);
+			if (poOverview->GetXSize() != w || poOverview->GetYSize() != h)
+			{
+				printf("Unexpected overview size\n");
+				err = CE_Failure;
+				break;
+			}
+			err = poOverview->RasterIO(GF_Write, 0, 0, w, h, (void*)&next[0], w, h, GDT_Float32, 0, 0);
+			level.swap(next);
+			src = &level[0];
+		}
+		if (err != CE_None)
+		{
+			GDALClose((GDALDatasetH)poMem);
+			return false;
+		}
+	}
+
+	char blockSize[16];
+	snprintf(blockSize, sizeof(blockSize), "%d", options.blockSize);
+	char** papszOptions = NULL;
+	papszOptions = CSLSetNameValue(papszOptions, "BLOCKSIZE", blockSize);
+	papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", options.compress.c_str());
+	papszOptions = CSLSetNameValue(papszOptions, "OVERVIEWS", "FORCE_USE_EXISTING");
+	papszOptions = CSLSetNameValue(papszOptions, "NUM_THREADS", "ALL_CPUS");
+	GDALDataset* poCog = poCogDriver->CreateCopy(path, poMem, FALSE, papszOptions, NULL, NULL);
+	CSLDestroy(papszOptions);
+	bool ok = poCog != NULL;
+	if (poCog != NULL) GDALClose((GDALDatasetH)poCog);
+	GDALClose((GDALDatasetH)poMem);
+	if (!ok) printf("Failed to write the COG %s\n", path);
+	return ok;
+}
@@ -0,0 +1,35 @@
+#ifndef COG_WRITER_HEAD_H
+#define COG_WRITER_HEAD_H
+
+#include <string>
+
+class CDEM;
+
+struct CogOptions
+{
+	//tile size of the full resolution and of every overview
+	int blockSize;
+	//COMPRESS of the GDAL COG driver: NONE, LZW, DEFLATE, ZSTD, ...
+	std::string compress;
+	//threads for the overview pyramid, 0 uses every hardware thread
+	int threads;
+	CogOptions()
+	{
+		blockSize = 512;
+		compress = "DEFLATE";
+		threads = 0;
+	}
+};
+
+/*
+*	Writes a float CDEM as a Cloud-Optimized GeoTIFF. The overview pyramid is
+*	built from the DEM in memory, halving level by level with the NoData-aware
+*	mean of each 2 x 2 block, rows split over threads, until a level fits in
+*	one tile. GDAL's COG driver then writes tiles and overviews in COG order
+*	in one pass (OVERVIEWS=FORCE_USE_EXISTING), so nothing is read back from
+*	the output. Needs GDAL 3.1 or later.
+*/
+bool CreateCOG(const char* path, const CDEM& dem, double* geoTransformArray6Eles,
+	double* min, double* max, double* mean, double* stdDev, double nodatavalue, const CogOptions& options);
+
+#endif
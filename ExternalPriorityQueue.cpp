@@ -0,0 +1,215 @@
+#include "ExternalPriorityQueue.h"
+#include <stdio.h>
+
+static bool BySpill(const Node& a, const Node& b)
+{
+	return a.spill < b.spill;
+}
+
+ExternalPriorityQueue::ExternalPriorityQueue()
+{
+	minRun = -1;
+	count = 0;
+	runFiles = 0;
+	spilledNodes = spills = merges = 0;
+	ioError = false;
+	SetMemoryBudget(0);
+}
+
+ExternalPriorityQueue::~ExternalPriorityQueue()
+{
+	clear();
+}
+
+//a quarter of the budget buffers the runs (and the cursors and the output
+//of a merge), the rest holds the hot heap
+void ExternalPriorityQueue::SetMemoryBudget(size_t bytes)
+{
+	budget = bytes;
+	if (bytes == 0)
+	{
+		heapCapacity = (size_t)-1;
+		runBufferNodes = 4096;
+		return;
+	}
+	runBufferNodes = bytes / 4 / (2 * SPILL_MAX_RUNS + 1) / sizeof(Node);
+	runBufferNodes = std::min(std::max(runBufferNodes, (size_t)256), (size_t)65536);
+	size_t buffers = (2 * SPILL_MAX_RUNS + 1) * runBufferNodes * sizeof(Node);
+	heapCapacity = std::max((bytes > buffers ? bytes - buffers : 0) / sizeof(Node), (size_t)1024);
+}
+
+void ExternalPriorityQueue::SetScratchPath(const std::string& path)
+{
+	scratchPath = path;
+}
+
+ExternalPriorityQueue::SpillRun* ExternalPriorityQueue::OpenRun()
+{
+	SpillRun* run = new SpillRun;
+	std::string path = scratchPath.empty() ? scratchPath : scratchPath + ".run" + std::to_string(runFiles++);
+	if (!run->file.Open(path))
+	{
+		delete run;
+		return NULL;
+	}
+	run->count = 0;
+	run->loaded = 0;
+	run->head = 0;
+	return run;
+}
+
+//read the next buffer of a run; false once the run is used up, or once it
+//cannot be read, which loses the nodes left in it
+bool ExternalPriorityQueue::Fill(SpillRun* run)
+{
+	size_t n = (size_t)std::min((unsigned long long)runBufferNodes, run->count - run->loaded);
+	run->buffer.resize(n);
+	run->head = 0;
+	if (n == 0) return false;
+	if (!run->file.Read(run->loaded * sizeof(Node), &run->buffer[0], n * sizeof(Node)))
+	{
+		if (!ioError) printf("Failed to read a priority queue run back\n");
+		ioError = true;
+		count -= (size_t)(run->count - run->loaded);
+		run->buffer.clear();
+		return false;
+	}
+	run->loaded += n;
+	return true;
+}
+
+void ExternalPriorityQueue::FindMinRun()
+{
+	minRun = -1;
+	for (int i = 0; i < (int)runs.size(); i++)
+	{
+		if (minRun < 0 || RunHead(i).spill < RunHead(minRun).spill) minRun = i;
+	}
+}
+
+//step past the head of a run, dropping the run once it is used up
+void ExternalPriorityQueue::Advance(int index)
+{
+	SpillRun* run = runs[index];
+	if (++run->head == run->buffer.size() && !Fill(run))
+	{
+		delete run;
+		runs.erase(runs.begin() + index);
+	}
+	FindMinRun();
+}
+
+//write the upper half of the hot heap as a sorted run
+void ExternalPriorityQueue::Spill()
+{
+	if (runs.size() >= SPILL_MAX_RUNS && !MergeRuns()) return;
+	SpillRun* run = OpenRun();
+	size_t keep = heap.size() / 2;
+	size_t n = heap.size() - keep;
+	//the heap order is rebuilt below, so partition it at the median
+	std::nth_element(heap.begin(), heap.begin() + keep, heap.end(), BySpill);
+	std::sort(heap.begin() + keep, heap.end(), BySpill);
+	if (run == NULL || !run->file.Write(0, &heap[keep], n * sizeof(Node)))
+	{
+		//keep everything in memory rather than lose cells
+		printf("Failed to write a priority queue run, the queue stays in memory\n");
+		heapCapacity = (size_t)-1;
+		delete run;
+		std::make_heap(heap.begin(), heap.end(), Node::Greater());
+		return;
+	}
+	run->count = n;
+	heap.resize(keep);
+	std::make_heap(heap.begin(), heap.end(), Node::Greater());
+	if (Fill(run)) runs.push_back(run);
+	else delete run;
+	FindMinRun();
+	spills++;
+	spilledNodes += n;
+}
+
+//merge all runs into one, so the number of open runs and buffers stays bounded.
+//The runs are read through cursors of their own and dropped only once the
+//merged run is fully written; if it cannot be, they stay as they are and the
+//queue stops spilling. False in that case.
+bool ExternalPriorityQueue::MergeRuns()
+{
+	struct Cursor
+	{
+		SpillRun* run;
+		unsigned long long loaded;
+		std::vector<Node> buffer;
+		size_t head;
+	};
+	std::vector<Cursor> cursors(runs.size());
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		cursors[i].run = runs[i];
+		cursors[i].loaded = runs[i]->loaded;
+		cursors[i].buffer.assign(runs[i]->buffer.begin() + runs[i]->head, runs[i]->buffer.end());
+		cursors[i].head = 0;
+	}
+	SpillRun* merged = OpenRun();
+	bool ok = merged != NULL;
+	std::vector<Node> out;
+	out.reserve(runBufferNodes);
+	unsigned long long written = 0;
+	while (ok)
+	{
+		//cursor with the smallest head, -1 once all are used up
+		int next = -1;
+		for (int i = 0; i < (int)cursors.size(); i++)
+		{
+			if (cursors[i].head == cursors[i].buffer.size()) continue;
+			if (next < 0 || cursors[i].buffer[cursors[i].head].spill < cursors[next].buffer[cursors[next].head].spill) next = i;
+		}
+		if (next >= 0)
+		{
+			Cursor& cursor = cursors[next];
+			out.push_back(cursor.buffer[cursor.head]);
+			if (++cursor.head == cursor.buffer.size())
+			{
+				size_t n = (size_t)std::min((unsigned long long)runBufferNodes, cursor.run->count - cursor.loaded);
+				cursor.buffer.resize(n);
+				cursor.head = 0;
+				if (n > 0) ok = cursor.run->file.Read(cursor.loaded * sizeof(Node), &cursor.buffer[0], n * sizeof(Node));
+				cursor.loaded += n;
+			}
+		}
+		if (ok && !out.empty() && (out.size() == runBufferNodes || next < 0))
+		{
+			ok = merged->file.Write(written * sizeof(Node), &out[0], out.size() * sizeof(Node));
+			written += out.size();
+			out.clear();
+		}
+		if (next < 0) break;
+	}
+	if (!ok)
+	{
+		printf("Failed to merge the priority queue runs, the queue stays in memory\n");
+		delete merged;
+		heapCapacity = (size_t)-1;
+		return false;
+	}
+	for (size_t i = 0; i < runs.size(); i++) delete runs[i];
+	runs.clear();
+	merged->count = written;
+	if (Fill(merged)) runs.push_back(merged);
+	else delete merged;
+	FindMinRun();
+	merges++;
+	return true;
+}
+
+void ExternalPriorityQueue::clear()
+{
+	for (size_t i = 0; i < runs.size(); i++) delete runs[i];
+	runs.clear();
+	heap.clear();
+	minRun = -1;
+	count = 0;
+	runFiles = 0;
+	spilledNodes = spills = merges = 0;
+	ioError = false;
+	SetMemoryBudget(budget);
+}
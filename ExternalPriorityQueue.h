@@ -0,0 +1,117 @@
+#ifndef EXTERNAL_PRIORITY_QUEUE_HEAD_H
+#define EXTERNAL_PRIORITY_QUEUE_HEAD_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "Node.h"
+#include "LargeAlloc.h"
+#include "BlockCache.h"
+
+//at most this many runs are on disk; one more spill merges them into one
+#define SPILL_MAX_RUNS 16
+
+/*
+*	Priority queue of Nodes under a RAM budget. Pushes go to a hot binary
+*	heap in memory; when the heap reaches its share of the budget, its upper
+*	half is sorted and written to a scratch file as a run, so the cells about
+*	to be popped stay in memory. top() is the smaller of the heap top and the
+*	smallest run head; each run is read back through a small buffer. Budget 0
+*	(the default) never spills. Interface matches std::priority_queue<Node,
+*	..., Node::Greater> so it can stand in for the PriorityQueue typedef.
+*/
+class ExternalPriorityQueue
+{
+private:
+	struct SpillRun
+	{
+		ScratchFile file;
+		unsigned long long count;
+		//nodes already read from the file
+		unsigned long long loaded;
+		std::vector<Node> buffer;
+		size_t head;
+	};
+	std::vector<Node, LargeAllocator<Node> > heap;
+	std::vector<SpillRun*> runs;
+	//run holding the smallest head, -1 without runs
+	int minRun;
+	size_t count;
+	size_t budget;
+	size_t heapCapacity;
+	size_t runBufferNodes;
+	std::string scratchPath;
+	int runFiles;
+	long long spilledNodes, spills, merges;
+	bool ioError;
+
+	void Spill();
+	bool MergeRuns();
+	SpillRun* OpenRun();
+	bool Fill(SpillRun* run);
+	void Advance(int index);
+	void FindMinRun();
+	inline bool RunFirst() const
+	{
+		return minRun >= 0 && (heap.empty() || RunHead(minRun).spill < heap.front().spill);
+	}
+	inline const Node& RunHead(int index) const
+	{
+		return runs[index]->buffer[runs[index]->head];
+	}
+public:
+	ExternalPriorityQueue();
+	~ExternalPriorityQueue();
+	//bytes of RAM for the hot heap and the run buffers; 0 keeps everything in memory
+	void SetMemoryBudget(size_t bytes);
+	size_t GetMemoryBudget() const { return budget; }
+	//prefix of the run files; empty (the default) uses tmpfile()
+	void SetScratchPath(const std::string& path);
+	bool empty() const
+	{
+		return count == 0;
+	}
+	size_t size() const
+	{
+		return count;
+	}
+	void push(const Node& node)
+	{
+		heap.push_back(node);
+		std::push_heap(heap.begin(), heap.end(), Node::Greater());
+		count++;
+		if (heap.size() >= heapCapacity) Spill();
+	}
+	const Node& top() const
+	{
+		return RunFirst() ? RunHead(minRun) : heap.front();
+	}
+	//true if the next node is at spill, as RadixHeap::hasAt
+	bool hasAt(float spill) const
+	{
+		return count > 0 && top().spill == spill;
+	}
+	void pop()
+	{
+		if (RunFirst())
+		{
+			Advance(minRun);
+		}
+		else
+		{
+			std::pop_heap(heap.begin(), heap.end(), Node::Greater());
+			heap.pop_back();
+		}
+		count--;
+	}
+	//drop the nodes and the run files, keep the heap capacity
+	void clear();
+	long long GetSpilledNodes() const { return spilledNodes; }
+	long long GetSpills() const { return spills; }
+	long long GetMerges() const { return merges; }
+	//true once a run could not be read back; the nodes left in it are lost.
+	//A run that cannot be written keeps its nodes in memory instead.
+	bool Failed() const { return ioError; }
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include "gdal_priv.h"
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
+#include "TerrainProfile.h"
+
+using namespace std;
+
+void FillDEM_Zhou_OnePass(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+int FillDEM_Wang(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+void FillDEM_Zhou_TwoPass(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+void FillDEM_Zhou_Direct(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+void fillDEM(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+
+struct ProfileCounts
+{
+	long long cells, noData, valid, minima, border;
+	long long pairs, flatPairs;
+};
+
+//profile the row mid of a buffer of count rows against its neighbours;
+//rows missing above or below are outside the grid
+static void ProfileRow(const float* rows, int width, int mid, int count, ProfileCounts& counts)
+{
+	const float* line = rows + (size_t)mid * width;
+	for (int col = 0; col < width; col++)
+	{
+		counts.cells++;
+		float z = line[col];
+		if (z == NO_DATA_VALUE)
+		{
+			counts.noData++;
+			continue;
+		}
+		counts.valid++;
+		bool border = false;
+		bool lowest = true;
+		for (int i = 0; i < 8; i++)
+		{
+			int iRow = Get_rowTo<D8>(i, mid);
+			int iCol = Get_colTo<D8>(i, col);
+			if (iRow < 0 || iRow >= count || iCol < 0 || iCol >= width)
+			{
+				border = true;
+				continue;
+			}
+			float iz = rows[(size_t)iRow * width + iCol];
+			if (iz == NO_DATA_VALUE)
+			{
+				border = true;
+				continue;
+			}
+			counts.pairs++;
+			if (iz == z) counts.flatPairs++;
+			if (iz <= z) lowest = false;
+		}
+		if (border) counts.border++;
+		else if (lowest) counts.minima++;
+	}
+}
+
+bool ProfileTerrain(const char* path, TerrainProfile& profile)
+{
+	PhaseSpan span("terrain profile");
+	GDALAllRegister();
+	CPLSetConfigOption("GDAL_FILENAME_IS_UTF8", "NO");
+	GDALDataset* poDataset = (GDALDataset*)GDALOpen(path, GA_ReadOnly);
+	if (poDataset == NULL)
+	{
+		printf("Failed to read the GeoTIFF file\n");
+		return false;
+	}
+	GDALRasterBand* poBand = poDataset->GetRasterBand(1);
+	int width = poBand->GetXSize();
+	int height = poBand->GetYSize();
+	int hasNoData = 0;
+	double fileNoData = poBand->GetNoDataValue(&hasNoData);
+
+	ProfileCounts counts = { 0, 0, 0, 0, 0, 0, 0 };
+	std::vector<float> rows((size_t)3 * width);
+	int samples = std::min(PROFILE_SAMPLES, height);
+	for (int s = 0; s < samples; s++)
+	{
+		//the middle of each of samples equal bands
+		int row = (int)((2LL * s + 1) * height / (2 * samples));
+		int first = std::max(row - 1, 0);
+		int count = std::min(row + 1, height - 1) - first + 1;
+		if (poBand->RasterIO(GF_Read, 0, first, width, count,
+			(void*)&rows[0], width, count, GDT_Float32, 0, 0) != CE_None)
+		{
+			GDALClose((GDALDatasetH)poDataset);
+			return false;
+		}
+		CDEM::NormalizeNoData(&rows[0], (size_t)count * width, hasNoData != 0, (float)fileNoData);
+		ProfileRow(&rows[0], width, row - first, count, counts);
+	}
+	GDALClose((GDALDatasetH)poDataset);
+
+	profile.width = width;
+	profile.height = height;
+	profile.sampledCells = counts.cells;
+	profile.validCells = counts.valid;
+	profile.noDataFraction = counts.cells > 0 ? (double)counts.noData / counts.cells : 0;
+	profile.minimaFraction = counts.valid > 0 ? (double)counts.minima / counts.valid : 0;
+	profile.borderFraction = counts.valid > 0 ? (double)counts.border / counts.valid : 0;
+	profile.flatFraction = counts.pairs > 0 ? (double)counts.flatPairs / counts.pairs : 0;
+	return true;
+}
+
+const char* FillEngineName(FillEngine engine)
+{
+	switch (engine)
+	{
+	case FILL_ENGINE_WANG: return "Wang & Liu (2006)";
+	case FILL_ENGINE_BARNES: return "Barnes et al. (2014)";
+	case FILL_ENGINE_ZHOU_ONEPASS: return "Zhou one-pass";
+	case FILL_ENGINE_ZHOU_TWOPASS: return "Zhou two-pass";
+	case FILL_ENGINE_ZHOU_DIRECT: return "Zhou direct";
+	case FILL_ENGINE_WEI: return "Wei et al. (2019)";
+	}
+	return "unknown";
+}
+
+/*
+*	Calibrated on 2500 x 2500 synthetic DEMs on one core: noise sweeps over
+*	a sloping surface, terraced slopes, random flats and 20% NoData blobs.
+*	Wei was fastest while pits and flats were rare, because its slope traces
+*	keep most cells out of the priority queue; Barnes was fastest once they
+*	were common, because its pit queue absorbs them. Each share is divided
+*	by its scale and Barnes is picked once the sum reaches 1. Alone, the
+*	terms switch at 4% local minima or 60% flat neighbours, a little below
+*	the measured ties (5% and 85%), since pits mixed with flats favoured
+*	Barnes earlier. Wang was never faster than Barnes and the Zhou variants
+*	never faster than Wei.
+*/
+static const double MINIMA_SCALE = 0.04;
+static const double FLAT_SCALE = 0.60;
+static const double BORDER_SCALE = 2.0;
+
+FillEngine ChooseFillEngine(const TerrainProfile& profile, std::string& reasons)
+{
+	double minimaScore = profile.minimaFraction / MINIMA_SCALE;
+	double flatScore = profile.flatFraction / FLAT_SCALE;
+	double borderScore = profile.borderFraction / BORDER_SCALE;
+	double score = minimaScore + flatScore + borderScore;
+	FillEngine engine = score >= 1 ? FILL_ENGINE_BARNES : FILL_ENGINE_WEI;
+
+	char text[512];
+	snprintf(text, sizeof(text),
+		"local minima %.2f%% (score %.2f), flat neighbours %.2f%% (%.2f), border cells %.2f%% (%.2f), NoData %.2f%%\n"
+		"  pit and flat score %.2f %s 1: %s",
+		100 * profile.minimaFraction, minimaScore, 100 * profile.flatFraction, flatScore,
+		100 * profile.borderFraction, borderScore, 100 * profile.noDataFraction,
+		score, score >= 1 ? ">=" : "<",
+		score >= 1 ? "pits and flats dominate, the pit queue absorbs them" : "mostly slopes, traced outside the priority queue");
+	reasons = text;
+	return engine;
+}
+
+//profiles the DEM, then runs the engine ChooseFillEngine picks
+int FillDEM_Auto(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	TerrainProfile profile;
+	if (!ProfileTerrain(inputFile, profile))
+	{
+		cout << "error!" << endl;
+		return 0;
+	}
+	std::string reasons;
+	FillEngine engine = ChooseFillEngine(profile, reasons);
+	cout << "Auto engine: " << FillEngineName(engine) << endl;
+	cout << "  " << reasons << endl;
+#ifdef USE_STD_PRIORITY_QUEUE
+	cout << "  priority queue: std::priority_queue (USE_STD_PRIORITY_QUEUE)" << endl;
+#elif defined(USE_EXTERNAL_PRIORITY_QUEUE)
+	cout << "  priority queue: ExternalPriorityQueue (USE_EXTERNAL_PRIORITY_QUEUE)" << endl;
+#else
+	cout << "  priority queue: RadixHeap" << endl;
+#endif
+
+	switch (engine)
+	{
+	case FILL_ENGINE_WANG:
+		return FillDEM_Wang(inputFile, outputFilledPath, progress, workspace);
+	case FILL_ENGINE_BARNES:
+		return FillDEM_Barnes(inputFile, outputFilledPath, progress, workspace);
+	case FILL_ENGINE_ZHOU_ONEPASS:
+		FillDEM_Zhou_OnePass(inputFile, outputFilledPath, progress, workspace);
+		break;
+	case FILL_ENGINE_ZHOU_TWOPASS:
+		FillDEM_Zhou_TwoPass(inputFile, outputFilledPath, progress, workspace);
+		break;
+	case FILL_ENGINE_ZHOU_DIRECT:
+		FillDEM_Zhou_Direct(inputFile, outputFilledPath, progress, workspace);
+		break;
+	case FILL_ENGINE_WEI:
+		fillDEM(inputFile, outputFilledPath, progress, workspace);
+		break;
+	}
+	return 1;
+}
@@ -6,6 +6,9 @@
 #include "dem.h" // DEMصͷļ  
 #include "Node.h" // ڵͷļ  
 #include "utils.h" // ߺͷļ  
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
 #include <time.h> // ʱ䴦ͷļ  
 #include <list> // ˫⣨Ȼδδֱʹã  
 #include <stack> // ջ⣨Ȼδδֱʹã  
@@ -13,19 +16,60 @@
 
 using namespace std; // ʹñ׼ռ  
 
-// Node  
-typedef std::vector<Node> NodeVector;
-// ȼУʹNodeΪԪأNodeVectorΪײNode::GreaterΪȽϺ  
-typedef std::priority_queue<Node, NodeVector, Node::Greater> PriorityQueue;
+
+//sends the unprocessed neighbours of (row, col) to pitque or the PQ; interior cells skip the bounds checks
+template <class NB, bool Interior>
+static void ProcessNeighbours_Barnes(CDEM& dem, Flag& flag, PriorityQueue& queue, NodeQueue& pitque, int row, int col, float spill)
+{
+	int iRow, iCol;
+	float iSpill;
+	Node tmpNode;
+	for (int i = 0; i < NB::Count; i++)
+	{
+		iRow = Get_rowTo<NB>(i, row);
+		iCol = Get_colTo<NB>(i, col);
+		if (!flag.IsProcessedAt<Interior>(iRow, iCol))
+		{
+			iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill <= spill)
+			{
+				dem.Set_Value(iRow, iCol, spill);
+				flag.SetFlag(iRow, iCol);
+
+				tmpNode.row = iRow;
+				tmpNode.col = iCol;
+				tmpNode.spill = spill;
+				pitque.push(tmpNode);
+			}
+			else
+			{
+				dem.Set_Value(iRow, iCol, iSpill);
+				flag.SetFlag(iRow, iCol);
+				tmpNode.row = iRow;
+				tmpNode.col = iCol;
+				tmpNode.spill = iSpill;
+				queue.push(tmpNode);
+			}
+
+		}
+
+	}
+}
 
 //The implementation of the Priority-Flood algorithm in Barnes et al. (2014)
-int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath)
+template <class NB>
+static int FillDEM_Barnes_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
 {
-	CDEM dem;
+	PhaseSpan run("FillDEM_Barnes");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	CDEM& dem = workspace->dem;
 	double geoTransformArgs[6];
 	double noDataValue = 0.0;
 	cout << "Reading tiff file..." << endl;
-	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
+	if (!workspace->ReadInput(inputFile, geoTransformArgs))
 	{
 		printf("Error occurred while reading GeoTIFF file!\n");
 		return 0;
@@ -37,64 +81,65 @@ int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath)
 
 	cout << "Using Barnes et al. (2014) method to fill DEM" << endl;
 
-	Flag flag;
-	if (!flag.Init(width, height)) {
+	if (!workspace->Prepare(width, height)) {
 		printf("Failed to allocate memory!\n");
 		return 0;
 	}
+	Flag& flag = workspace->flag;
+	Checkpointer& checkpoint = workspace->checkpoint;
 
 	cout << "\nStart filling depressions..." << endl;
-	time_t timeStart, timeEnd;
-	timeStart = time(NULL);
-
-	PriorityQueue queue;
-	std::queue<Node> pitque;
-	int validElementsCount = 0;
-	// push border cells into the PQ
-	for (int row = 0; row < height; row++)
+	PhaseSpan fillSpan("fill");
+
+	PriorityQueue& queue = workspace->priorityQueue;
+	NodeQueue& pitque = workspace->depressionQue;
+	long long validElementsCount = 0;
+	long long count = 0;
+	if (checkpoint.Resuming()) workspace->RestoreCheckpoint(count, validElementsCount);
+	else
 	{
-		for (int col = 0; col < width; col++)
+		// push border cells into the PQ
+		PhaseSpan seedSpan("border seeding");
+		for (int row = 0; row < height; row++)
 		{
-			Node tmpNode;
-			if (!dem.is_NoData(row, col))
+			for (int col = 0; col < width; col++)
 			{
-				validElementsCount++;
-				for (int i = 0; i < 8; i++)
+				Node tmpNode;
+				if (dem.is_Valid(row, col))
 				{
-					int iRow, iCol;
-					iRow = Get_rowTo(i, row);
-					iCol = Get_colTo(i, col);
-					if (!dem.is_InGrid(iRow, iCol) || dem.is_NoData(iRow, iCol))
+					validElementsCount++;
+					for (int i = 0; i < NB::Count; i++)
 					{
-						tmpNode.col = col;
-						tmpNode.row = row;
-						tmpNode.spill = dem.asFloat(row, col);
-						queue.push(tmpNode);
-						flag.SetFlag(row, col);
-						break;
+						int iRow, iCol;
+						iRow = Get_rowTo<NB>(i, row);
+						iCol = Get_colTo<NB>(i, col);
+						if (!dem.is_Valid(iRow, iCol))
+						{
+							tmpNode.col = col;
+							tmpNode.row = row;
+							tmpNode.spill = dem.asFloat(row, col);
+							queue.push(tmpNode);
+							flag.SetFlag(row, col);
+							break;
+						}
 					}
 				}
-			}
-			else {
-				flag.SetFlag(row, col);
+				else {
+					flag.SetFlag(row, col);
+				}
 			}
 		}
+		seedSpan.End();
 	}
-	int percentFive = validElementsCount / 20;
+	progress->SetTotal(validElementsCount);
+	checkpoint.Start("barnes", NB::Count, geoTransformArgs, validElementsCount, count);
 
-	int count = 0;
 	Node tmpNode;
-	int iRow, iCol;
-	float iSpill;
-	int i;
 	while (!queue.empty() || !pitque.empty())
 	{
+		if (checkpoint.Due(count)) workspace->SaveCheckpoint(count);
 		count++;
-		if (count % percentFive == 0)
-		{
-			int percentNum = count / percentFive;
-			cout << "Progress:" << percentNum * 5 << "%\r";
-		}
+		if (!progress->Poll(count)) break;
 		if (!pitque.empty()) {
 			tmpNode = pitque.front();
 			pitque.pop();
@@ -109,46 +154,32 @@ int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath)
 		float spill = tmpNode.spill;
 
 
-		for (i = 0; i < 8; i++)
-		{
-			iRow = Get_rowTo(i, row);
-			iCol = Get_colTo(i, col);
-			if (!flag.IsProcessed(iRow, iCol))
-			{
-				iSpill = dem.asFloat(iRow, iCol);
-				if (iSpill <= spill)
-				{
-					dem.Set_Value(iRow, iCol, spill);
-					flag.SetFlag(iRow, iCol);
-
-					tmpNode.row = iRow;
-					tmpNode.col = iCol;
-					tmpNode.spill = spill;
-					pitque.push(tmpNode);
-				}
-				else
-				{
-					dem.Set_Value(iRow, iCol, iSpill);
-					flag.SetFlag(iRow, iCol);
-					tmpNode.row = iRow;
-					tmpNode.col = iCol;
-					tmpNode.spill = iSpill;
-					queue.push(tmpNode);
-				}
-
-			}
-
-		}
+		if (IsInterior(row, col, width, height)) ProcessNeighbours_Barnes<NB, true>(dem, flag, queue, pitque, row, col, spill);
+		else ProcessNeighbours_Barnes<NB, false>(dem, flag, queue, pitque, row, col, spill);
 	}
-	timeEnd = time(NULL);
-	double consumeTime = difftime(timeEnd, timeStart);
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		//the cell of the last count was not taken yet
+		if (checkpoint.Enabled() && workspace->SaveCheckpoint(count - 1, true))
+			cout << "Checkpoint written to " << checkpoint.GetPath() << endl;
+		return false;
+	}
+	checkpoint.Finish(true);
+	double consumeTime = fillSpan.End();
 	cout << "\nTime used:" << consumeTime << " seconds" << endl;
 
 	// ͳļ  
 	double min, max, mean, stdDev;
 	calculateStatistics(dem, &min, &max, &mean, &stdDev);
-	CreateGeoTIFF(outputFilledPath, dem.Get_NY(), dem.Get_NX(),
-		(void*)dem.getDEMdata(), GDALDataType::GDT_Float32, geoTransformArgs,
+	return workspace->WriteOutput(outputFilledPath, geoTransformArgs,
 		&min, &max, &mean, &stdDev, -9999);
-	return true;
+}
+
+int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		return FillDEM_Barnes_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	return FillDEM_Barnes_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
 }
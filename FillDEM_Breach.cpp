@@ -0,0 +1,364 @@
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "FillDEM_Breach.h"
+#include "PhaseTrace.h"
+
+using namespace std;
+
+/*
+*	Least-cost breaching on the Priority-Flood (after Lindsay, 2016). The
+*	flood runs as in Barnes et al. (2014), except that cells keep their
+*	elevation and each one records the direction of the cell it was reached
+*	from. Following these back links from any cell leads to an outlet along
+*	a path whose highest point is as low as possible, and inside a
+*	depression (the pit queue) along a shortest one. When a pit, a cell with
+*	no lower neighbour, is popped, the cells on its path are lowered to the
+*	pit's elevation until the path reaches a lower cell or a pit that has
+*	already been handled. Cells are never raised, so roads and embankments
+*	are cut instead of the area behind them being filled.
+*/
+
+#define BACKLINK_NONE 0xFF
+
+//per cell the direction of the cell it was reached from (BACKLINK_NONE for
+//outlets), kept in the workspace between fills
+struct BreachState : public EngineState
+{
+	std::vector<unsigned char, LargeAllocator<unsigned char> > backLinks;
+	//the pits whose paths were cut; a pit left by the limits does not drain
+	Flag drained;
+};
+
+struct BreachCounts
+{
+	long long pits;
+	long long breached;
+	long long unbreached;
+	long long lowered;
+	//deepest cut below the input elevation, with a maxDepth
+	float largestCut;
+};
+
+//input elevation of every cell cut so far, by CDEM::Index, kept for a
+//maxDepth; a later path may cross a cell an earlier one has lowered
+typedef std::unordered_map<size_t, float> CutCells;
+
+//floods the unprocessed neighbours of (row, col) and links them back to it;
+//cells at or below the spill level go to pitque, as in Barnes et al. (2014)
+template <class NB, bool Interior>
+static void ProcessNeighbours_Breach(CDEM& dem, Flag& flag, unsigned char* backLinks, PriorityQueue& queue, NodeQueue& pitque, int row, int col, float spill)
+{
+	Node tmpNode;
+	for (int i = 0; i < NB::Count; i++)
+	{
+		int iRow = Get_rowTo<NB>(i, row);
+		int iCol = Get_colTo<NB>(i, col);
+		if (flag.IsProcessedAt<Interior>(iRow, iCol)) continue;
+		float iSpill = dem.asFloat(iRow, iCol);
+		flag.SetFlag(iRow, iCol);
+		backLinks[dem.Index(iRow, iCol)] = (unsigned char)((i + NB::Count / 2) % NB::Count);
+		tmpNode.row = iRow;
+		tmpNode.col = iCol;
+		if (iSpill <= spill)
+		{
+			tmpNode.spill = spill;
+			pitque.push(tmpNode);
+		}
+		else
+		{
+			tmpNode.spill = iSpill;
+			queue.push(tmpNode);
+		}
+	}
+}
+
+//lowers the path of the pit (row, col) to its elevation; false, with the DEM
+//unchanged, if the path is longer or deeper than options allow. Depths are
+//measured from the input elevation, so the cuts of several pits never add
+//up past maxDepth
+template <class NB>
+static bool BreachPit(CDEM& dem, Flag& drained, const unsigned char* backLinks, int row, int col,
+	const BreachOptions& options, CutCells* cutCells, BreachCounts& counts)
+{
+	float target = dem.asFloat(row, col);
+	for (int pass = options.maxLength > 0 || options.maxDepth > 0 ? 0 : 1; pass < 2; pass++)
+	{
+		//pass 0 only measures the path, pass 1 cuts it
+		int length = 0;
+		float depth = 0;
+		int r = row, c = col;
+		while (true)
+		{
+			unsigned char link = backLinks[dem.Index(r, c)];
+			if (link == BACKLINK_NONE) break;
+			r = Get_rowTo<NB>(link, r);
+			c = Get_colTo<NB>(link, c);
+			float z = dem.asFloat(r, c);
+			//a lower cell drains; so does a breached pit at the same level,
+			//since pits are handled in flood order
+			if (z < target || (z == target && drained.IsProcessedDirect(r, c))) break;
+			if (z == target) continue;
+			float original = z;
+			if (cutCells != NULL)
+			{
+				CutCells::const_iterator cut = cutCells->find(dem.Index(r, c));
+				if (cut != cutCells->end()) original = cut->second;
+			}
+			if (pass == 0)
+			{
+				length++;
+				depth = std::max(depth, original - target);
+				if ((options.maxLength > 0 && length > options.maxLength) ||
+					(options.maxDepth > 0 && depth > options.maxDepth)) return false;
+			}
+			else
+			{
+				//the first cut of a cell keeps its input elevation
+				if (cutCells != NULL && original == z) (*cutCells)[dem.Index(r, c)] = z;
+				dem.Set_Value(r, c, target);
+				counts.lowered++;
+				counts.largestCut = std::max(counts.largestCut, original - target);
+			}
+		}
+	}
+	return true;
+}
+
+//Barnes et al. (2014) fill of what is left after a limited breach
+template <class NB>
+static void FillRemaining(CDEM& dem, Flag& flag, PriorityQueue& queue, NodeQueue& pitque, ProgressSink& progress, long long& count)
+{
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	Node tmpNode;
+	for (int row = 0; row < height; row++)
+	{
+		for (int col = 0; col < width; col++)
+		{
+			if (!dem.is_Valid(row, col))
+			{
+				flag.SetFlag(row, col);
+				continue;
+			}
+			for (int i = 0; i < NB::Count; i++)
+			{
+				if (!dem.is_Valid(Get_rowTo<NB>(i, row), Get_colTo<NB>(i, col)))
+				{
+					tmpNode.row = row;
+					tmpNode.col = col;
+					tmpNode.spill = dem.asFloat(row, col);
+					queue.push(tmpNode);
+					flag.SetFlag(row, col);
+					break;
+				}
+			}
+		}
+	}
+	while (!queue.empty() || !pitque.empty())
+	{
+		count++;
+		if (!progress.Poll(count)) return;
+		if (!pitque.empty())
+		{
+			tmpNode = pitque.front();
+			pitque.pop();
+		}
+		else
+		{
+			tmpNode = queue.top();
+			queue.pop();
+		}
+		for (int i = 0; i < NB::Count; i++)
+		{
+			int iRow = Get_rowTo<NB>(i, tmpNode.row);
+			int iCol = Get_colTo<NB>(i, tmpNode.col);
+			if (flag.IsProcessed(iRow, iCol)) continue;
+			flag.SetFlag(iRow, iCol);
+			Node node;
+			node.row = iRow;
+			node.col = iCol;
+			float iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill <= tmpNode.spill)
+			{
+				dem.Set_Value(iRow, iCol, tmpNode.spill);
+				node.spill = tmpNode.spill;
+				pitque.push(node);
+			}
+			else
+			{
+				node.spill = iSpill;
+				queue.push(node);
+			}
+		}
+	}
+}
+
+template <class NB>
+static int FillDEM_Breach_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace,
+	const BreachOptions& options)
+{
+	PhaseSpan run("FillDEM_Breach");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	CDEM& dem = workspace->dem;
+	double geoTransformArgs[6];
+	cout << "Reading tiff file..." << endl;
+	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
+	{
+		printf("Error occurred while reading GeoTIFF file!\n");
+		return 0;
+	}
+
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	cout << "DEM Width:" << width << "  Height:" << height << endl;
+
+	cout << "Using least-cost breaching" << (options.fill ? " then filling" : "") << endl;
+
+	if (!workspace->Prepare(width, height, 2)) {
+		printf("Failed to allocate memory!\n");
+		return 0;
+	}
+	Flag& flag = workspace->flag;
+	//flag2 marks the pits
+	Flag& pits = workspace->flag2;
+	BreachState* state = workspace->GetEngineState<BreachState>();
+	std::vector<unsigned char, LargeAllocator<unsigned char> >& backLinks = state->backLinks;
+	backLinks.resize(Flag::Cells(width, height));
+	Flag& drained = state->drained;
+	if (!drained.Init(width, height)) {
+		printf("Failed to allocate memory!\n");
+		return 0;
+	}
+
+	cout << "\nStart breaching depressions..." << endl;
+	PhaseSpan fillSpan("fill");
+
+	PriorityQueue& queue = workspace->priorityQueue;
+	NodeQueue& pitque = workspace->depressionQue;
+	long long validElementsCount = 0;
+	BreachCounts counts = { 0, 0, 0, 0, 0 };
+	CutCells cutCells;
+	// push border cells into the PQ, mark the pits of the interior
+	PhaseSpan seedSpan("border seeding");
+	for (int row = 0; row < height; row++)
+	{
+		for (int col = 0; col < width; col++)
+		{
+			if (!dem.is_Valid(row, col))
+			{
+				flag.SetFlag(row, col);
+				continue;
+			}
+			validElementsCount++;
+			float z = dem.asFloat(row, col);
+			bool border = false;
+			bool pit = true;
+			for (int i = 0; i < NB::Count; i++)
+			{
+				int iRow = Get_rowTo<NB>(i, row);
+				int iCol = Get_colTo<NB>(i, col);
+				if (!dem.is_Valid(iRow, iCol))
+				{
+					border = true;
+					break;
+				}
+				if (dem.asFloat(iRow, iCol) < z) pit = false;
+			}
+			if (border)
+			{
+				Node tmpNode;
+				tmpNode.row = row;
+				tmpNode.col = col;
+				tmpNode.spill = z;
+				queue.push(tmpNode);
+				flag.SetFlag(row, col);
+				backLinks[dem.Index(row, col)] = BACKLINK_NONE;
+			}
+			else if (pit)
+			{
+				pits.SetFlag(row, col);
+				counts.pits++;
+			}
+		}
+	}
+	seedSpan.End();
+	progress->SetTotal(options.fill ? 2 * validElementsCount : validElementsCount);
+
+	long long count = 0;
+	Node tmpNode;
+	while (!queue.empty() || !pitque.empty())
+	{
+		count++;
+		if (!progress->Poll(count)) break;
+		if (!pitque.empty()) {
+			tmpNode = pitque.front();
+			pitque.pop();
+		}
+		else
+		{
+			tmpNode = queue.top();
+			queue.pop();
+		}
+		int row = tmpNode.row;
+		int col = tmpNode.col;
+		if (pits.IsProcessedDirect(row, col))
+		{
+			if (BreachPit<NB>(dem, drained, &backLinks[0], row, col, options, options.maxDepth > 0 ? &cutCells : NULL, counts))
+			{
+				drained.SetFlag(row, col);
+				counts.breached++;
+			}
+			else counts.unbreached++;
+		}
+
+		if (IsInterior(row, col, width, height)) ProcessNeighbours_Breach<NB, true>(dem, flag, &backLinks[0], queue, pitque, row, col, tmpNode.spill);
+		else ProcessNeighbours_Breach<NB, false>(dem, flag, &backLinks[0], queue, pitque, row, col, tmpNode.spill);
+	}
+	if (options.fill && !progress->Stopped())
+	{
+		PhaseSpan fillRestSpan("fill remaining");
+		//the radix heap only takes keys above the last one popped
+		queue.clear();
+		flag.Init(width, height);
+		FillRemaining<NB>(dem, flag, queue, pitque, *progress, count);
+	}
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nBreaching stopped: " << progress->GetStatusText() << endl;
+		return false;
+	}
+	double consumeTime = fillSpan.End();
+	cout << "\nTime used:" << consumeTime << " seconds" << endl;
+	cout << "Pits: " << counts.pits << "  breached: " << counts.breached
+		<< "  left: " << counts.unbreached << "  cells cut: " << counts.lowered << endl;
+	if (options.maxDepth > 0)
+	{
+		cout << "Largest cut: " << counts.largestCut << " (limit " << options.maxDepth << ")" << endl;
+	}
+
+	double min, max, mean, stdDev;
+	calculateStatistics(dem, &min, &max, &mean, &stdDev);
+	return workspace->WriteOutput(outputFilledPath, geoTransformArgs,
+		&min, &max, &mean, &stdDev, -9999);
+}
+
+int FillDEM_Breach(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace,
+	const BreachOptions* options)
+{
+	BreachOptions defaults;
+	if (options == NULL) options = &defaults;
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		return FillDEM_Breach_Impl<D4>(inputFile, outputFilledPath, progress, workspace, *options);
+	return FillDEM_Breach_Impl<D8>(inputFile, outputFilledPath, progress, workspace, *options);
+}
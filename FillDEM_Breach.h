@@ -0,0 +1,29 @@
+#ifndef FILLDEM_BREACH_HEAD_H
+#define FILLDEM_BREACH_HEAD_H
+
+#include "progress.h"
+#include "FillWorkspace.h"
+
+//limits of FillDEM_Breach; a pit whose breach path exceeds one is left alone
+struct BreachOptions
+{
+	//cells lowered along the path, 0 = unlimited
+	int maxLength;
+	//largest lowering of one path cell, 0 = unlimited
+	float maxDepth;
+	//fill what could not be breached ("breach then fill")
+	bool fill;
+	BreachOptions()
+	{
+		maxLength = 0;
+		maxDepth = 0;
+		fill = false;
+	}
+};
+
+//least-cost breaching (FillDEM_Breach.cpp); options == NULL breaches every
+//pit without limits and fills nothing
+int FillDEM_Breach(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL,
+	FillWorkspace* workspace = NULL, const BreachOptions* options = NULL);
+
+#endif
@@ -58,7 +58,7 @@ int FillDEM_PD(const char* inputFile, const char* outputFilledPath)
 	{
 		for (int col = 0; col < width; ++col)
 		{
-			if (DEM.is_NoData(row, col))
+			if (!DEM.is_Valid(row, col))
 			{
 				W.Set_Value(row, col, DEM.asFloat(row, col));
 			}
@@ -70,7 +70,7 @@ int FillDEM_PD(const char* inputFile, const char* outputFilledPath)
 				{
 					int iRow = Get_rowTo(i, row);
 					int iCol = Get_colTo(i, col);
-					if (!DEM.is_InGrid(iRow, iCol) || DEM.is_NoData(iRow, iCol))
+					if (!DEM.is_Valid(iRow, iCol))
 					{
 						isborder = true;
 						break;
@@ -84,7 +84,9 @@ int FillDEM_PD(const char* inputFile, const char* outputFilledPath)
 				else
 				{
 					W.Set_Value(row, col, m);
-					Node node(row, col);
+					Node node;
+					node.row = row;
+					node.col = col;
 					S1.push(node);
 				}
 
@@ -165,8 +167,7 @@ int FillDEM_PD(const char* inputFile, const char* outputFilledPath)
 
 	calculateStatistics(W, &min, &max, &mean, &stdDev);
 
-	CreateGeoTIFF(outputFilledPath, W.Get_NY(), W.Get_NX(),
-		(void*)W.getDEMdata(), GDALDataType::GDT_Float32, geoTransformArgs,
+	CreateGeoTIFF(outputFilledPath, W, geoTransformArgs,
 		&min, &max, &mean, &stdDev, -9999);
 
 	return 1;
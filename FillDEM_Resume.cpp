@@ -0,0 +1,57 @@
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
+
+using namespace std;
+
+void FillDEM_Zhou_OnePass(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+int FillDEM_Wang(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace);
+
+/*
+*	Continues a fill from a snapshot of Checkpoint.h. The engine that wrote
+*	it runs again with the DEM, the flags and the queues of the snapshot
+*	instead of the GeoTIFF and its border seeding, and writes the output an
+*	uninterrupted run would have. Later snapshots go to checkpointPath
+*	unless workspace->checkpoint has a path of its own; the snapshot is
+*	deleted once the fill completes.
+*/
+int FillDEM_Resume(const char* checkpointPath, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	PhaseSpan run("FillDEM_Resume");
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	Checkpointer& checkpoint = workspace->checkpoint;
+	//neither knows the cells changed before the snapshot
+	if (workspace->depth.GetFormat() != FILL_DEPTH_NONE || workspace->outputFormat == OUTPUT_UPDATE)
+	{
+		printf("Fill depth and in-place updates cannot be resumed from a checkpoint!\n");
+		return 0;
+	}
+	if (!checkpoint.Open(checkpointPath)) return 0;
+	const CheckpointHeader& header = checkpoint.GetHeader();
+	cout << "Resuming " << header.engine << " from " << checkpointPath << ": "
+		<< header.done << " of " << header.total << " cells done" << endl;
+	if (checkpoint.GetPath().empty()) checkpoint.SetPath(checkpointPath);
+	workspace->connectivity = header.connectivity == 4 ? CONNECTIVITY_D4 : CONNECTIVITY_D8;
+
+	if (strcmp(header.engine, "barnes") == 0)
+		return FillDEM_Barnes(checkpointPath, outputFilledPath, progress, workspace);
+	if (strcmp(header.engine, "wang") == 0)
+		return FillDEM_Wang(checkpointPath, outputFilledPath, progress, workspace);
+	if (strcmp(header.engine, "zhou-onepass") == 0)
+	{
+		FillDEM_Zhou_OnePass(checkpointPath, outputFilledPath, progress, workspace);
+		return 1;
+	}
+	printf("Unknown engine in the checkpoint: %s\n", header.engine);
+	checkpoint.Finish(false);
+	return 0;
+}
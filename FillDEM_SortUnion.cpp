@@ -0,0 +1,296 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
+
+using namespace std;
+
+/*
+*	Depression filling without a priority queue. All valid cells are sorted
+*	by elevation once, by a parallel LSD radix sort on the order-preserving
+*	key of RadixHeap.h, and swept upwards. Each swept cell is joined with its
+*	swept neighbours in a union-find; a set drains once it holds a cell next
+*	to NoData or the edge of the grid. When a set that did not drain is
+*	joined to one that does at level z, its root records z: z is the spill
+*	level of all its cells, so the first recorded node on a cell's chain of
+*	parents holds the cell's filled value. Paths are compressed only where
+*	that cannot skip a record: sets that did not drain hold none, and in a
+*	drained set every node on the path records its value before it is
+*	linked to the root. The final lookup only reads the union-find, so the
+*	write runs on the threads of workspace->tracePool, as the sort does. The
+*	sweep touches the cells in sorted order rather than in the order of a
+*	heap, and the output is that of the Priority-Flood engines.
+*/
+
+//cells per thread below which the sort and the write stay on fewer threads
+#define SORT_UNION_GRAIN 65536
+
+//one node of the union-find; drainLevel is the level the node's set
+//reached an outlet at, valid once recorded is set
+struct UnionCell
+{
+	unsigned int parent;
+	float drainLevel;
+	unsigned char rank;
+	//set at roots whose set reaches an outlet
+	unsigned char draining;
+	unsigned char recorded;
+};
+
+//buffers kept in the workspace between fills: the sort keys of the valid
+//cells, the radix sort's scratch and the union-find
+struct SortUnionState : public EngineState
+{
+	std::vector<unsigned long long, LargeAllocator<unsigned long long> > keys;
+	std::vector<unsigned long long, LargeAllocator<unsigned long long> > scratch;
+	std::vector<UnionCell, LargeAllocator<UnionCell> > cells;
+};
+
+//runs work(t) for t = 0 .. threads - 1, t = 0 on the calling thread
+template <class Work>
+static void RunThreads(int threads, Work work)
+{
+	std::vector<std::thread> pool;
+	for (int t = 1; t < threads; t++) pool.push_back(std::thread(work, t));
+	work(0);
+	for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+}
+
+//sorts the keys, ordered key in the high and cell index in the low 32 bits,
+//by their high 32 bits; LSD passes of 8 bits, each thread counting and
+//then scattering its own contiguous share, so the sort is stable
+static void RadixSortKeys(std::vector<unsigned long long, LargeAllocator<unsigned long long> >& keys,
+	std::vector<unsigned long long, LargeAllocator<unsigned long long> >& scratch, int threads)
+{
+	size_t n = keys.size();
+	scratch.resize(n);
+	std::vector<size_t> counts((size_t)threads * 256);
+	for (int shift = 32; shift < 64; shift += 8)
+	{
+		RunThreads(threads, [&](int t) {
+			size_t* count = &counts[(size_t)t * 256];
+			std::fill(count, count + 256, (size_t)0);
+			size_t end = n * (t + 1) / threads;
+			for (size_t i = n * t / threads; i < end; i++) count[(keys[i] >> shift) & 255]++;
+		});
+		//bucket offsets in (digit, thread) order; a pass with one bucket would not move a key
+		bool moves = true;
+		size_t offset = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			size_t before = offset;
+			for (int t = 0; t < threads; t++)
+			{
+				size_t count = counts[(size_t)t * 256 + digit];
+				counts[(size_t)t * 256 + digit] = offset;
+				offset += count;
+			}
+			if (offset - before == n) moves = false;
+		}
+		if (!moves) continue;
+		RunThreads(threads, [&](int t) {
+			size_t* next = &counts[(size_t)t * 256];
+			size_t end = n * (t + 1) / threads;
+			for (size_t i = n * t / threads; i < end; i++) scratch[next[(keys[i] >> shift) & 255]++] = keys[i];
+		});
+		keys.swap(scratch);
+	}
+}
+
+//the root of cell's set, with the path compressed; union by rank keeps
+//paths shorter than 32 nodes
+static unsigned int FindRoot(UnionCell* cells, unsigned int cell)
+{
+	unsigned int path[32];
+	int length = 0;
+	unsigned int root = cell;
+	while (cells[root].parent != root)
+	{
+		path[length++] = root;
+		root = cells[root].parent;
+	}
+	if (length < 2) return root;
+	if (cells[root].draining)
+	{
+		//each node takes the level of the nearest record at or above it
+		int resolved = 0;
+		for (int i = 0; i <= length; i++)
+		{
+			unsigned int node = i < length ? path[i] : root;
+			if (!cells[node].recorded) continue;
+			for (; resolved < i; resolved++)
+			{
+				cells[path[resolved]].drainLevel = cells[node].drainLevel;
+				cells[path[resolved]].recorded = 1;
+			}
+			resolved = i + 1;
+		}
+	}
+	for (int i = 0; i < length - 1; i++) cells[path[i]].parent = root;
+	return root;
+}
+
+//joins the sets of a and b at level; a set that did not drain and is
+//joined to one that does records level at its root
+static void Join(UnionCell* cells, unsigned int a, unsigned int b, float level)
+{
+	unsigned int ra = FindRoot(cells, a);
+	unsigned int rb = FindRoot(cells, b);
+	if (ra == rb) return;
+	if (cells[ra].draining != cells[rb].draining)
+	{
+		UnionCell& closed = cells[ra].draining ? cells[rb] : cells[ra];
+		closed.drainLevel = level;
+		closed.recorded = 1;
+	}
+	unsigned char draining = cells[ra].draining | cells[rb].draining;
+	if (cells[ra].rank < cells[rb].rank) std::swap(ra, rb);
+	cells[rb].parent = ra;
+	if (cells[ra].rank == cells[rb].rank) cells[ra].rank++;
+	cells[ra].draining = draining;
+}
+
+template <class NB>
+static int FillDEM_SortUnion_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	PhaseSpan run("FillDEM_SortUnion");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	CDEM& dem = workspace->dem;
+	double geoTransformArgs[6];
+	cout << "Reading tiff file..." << endl;
+	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
+	{
+		printf("Error occurred while reading GeoTIFF file!\n");
+		return 0;
+	}
+
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	cout << "DEM Width:" << width << "  Height:" << height << endl;
+	if ((size_t)width * height >= 0xFFFFFFFFu)
+	{
+		printf("The sort-and-union-find fill indexes cells with 32 bits; the DEM is too large!\n");
+		return 0;
+	}
+
+	int threads = workspace->tracePool.GetThreads();
+	cout << "Using sort and union-find on " << threads << " threads" << endl;
+
+	if (!workspace->Prepare(width, height)) {
+		printf("Failed to allocate memory!\n");
+		return 0;
+	}
+	Flag& flag = workspace->flag;
+	SortUnionState* state = workspace->GetEngineState<SortUnionState>();
+	std::vector<unsigned long long, LargeAllocator<unsigned long long> >& keys = state->keys;
+	std::vector<UnionCell, LargeAllocator<UnionCell> >& unionCells = state->cells;
+	unionCells.resize((size_t)width * height);
+	UnionCell* cells = &unionCells[0];
+
+	cout << "\nStart filling depressions..." << endl;
+	PhaseSpan fillSpan("fill");
+
+	{
+		PhaseSpan sortSpan("sort");
+		keys.clear();
+		keys.reserve((size_t)width * height);
+		for (int row = 0; row < height; row++)
+		{
+			for (int col = 0; col < width; col++)
+			{
+				if (!dem.is_Valid(row, col)) continue;
+				unsigned int index = (unsigned int)((size_t)row * width + col);
+				keys.push_back(((unsigned long long)FloatToOrderedKey(dem.asFloat(row, col)) << 32) | index);
+			}
+		}
+		int sortThreads = (int)std::max((size_t)1, std::min((size_t)threads, keys.size() / SORT_UNION_GRAIN));
+		RadixSortKeys(keys, state->scratch, sortThreads);
+	}
+	long long validElementsCount = (long long)keys.size();
+	progress->SetTotal(validElementsCount);
+
+	long long count = 0;
+	{
+		PhaseSpan sweepSpan("union-find sweep");
+		for (size_t k = 0; k < keys.size(); k++)
+		{
+			count++;
+			if (!progress->Poll(count)) break;
+			unsigned int index = (unsigned int)keys[k];
+			int row = (int)(index / width);
+			int col = (int)(index % width);
+			float z = OrderedKeyToFloat((unsigned int)(keys[k] >> 32));
+			unsigned int swept[NB::Count];
+			int sweptCount = 0;
+			bool outlet = false;
+			for (int i = 0; i < NB::Count; i++)
+			{
+				int iRow = Get_rowTo<NB>(i, row);
+				int iCol = Get_colTo<NB>(i, col);
+				if (!dem.is_Valid(iRow, iCol)) outlet = true;
+				else if (flag.IsProcessedDirect(iRow, iCol)) swept[sweptCount++] = (unsigned int)((size_t)iRow * width + iCol);
+			}
+			UnionCell& cell = cells[index];
+			cell.parent = index;
+			cell.rank = 0;
+			//an outlet drains at its own elevation
+			cell.draining = outlet;
+			cell.recorded = outlet;
+			cell.drainLevel = z;
+			flag.SetFlag(row, col);
+			for (int i = 0; i < sweptCount; i++) Join(cells, index, swept[i], z);
+		}
+	}
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		return false;
+	}
+
+	{
+		PhaseSpan writeSpan("write filled values");
+		//the blocks of compressed or paged storage and the depth recorder are not thread-safe
+		int writeThreads = dem.GetBlocks() == NULL && workspace->depth.GetFormat() == FILL_DEPTH_NONE ?
+			std::max(1, std::min(threads, (int)((long long)width * height / SORT_UNION_GRAIN))) : 1;
+		writeThreads = std::min(writeThreads, height);
+		RunThreads(writeThreads, [&](int t) {
+			int end = (int)((long long)height * (t + 1) / writeThreads);
+			for (int row = (int)((long long)height * t / writeThreads); row < end; row++)
+			{
+				for (int col = 0; col < width; col++)
+				{
+					if (!dem.is_Valid(row, col)) continue;
+					unsigned int node = (unsigned int)((size_t)row * width + col);
+					while (!cells[node].recorded) node = cells[node].parent;
+					float level = cells[node].drainLevel;
+					if (level != dem.asFloat(row, col)) dem.Set_Value(row, col, level);
+				}
+			}
+		});
+	}
+	double consumeTime = fillSpan.End();
+	cout << "\nTime used:" << consumeTime << " seconds" << endl;
+
+	double min, max, mean, stdDev;
+	calculateStatistics(dem, &min, &max, &mean, &stdDev);
+	return workspace->WriteOutput(outputFilledPath, geoTransformArgs,
+		&min, &max, &mean, &stdDev, -9999);
+}
+
+int FillDEM_SortUnion(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		return FillDEM_SortUnion_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	return FillDEM_SortUnion_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
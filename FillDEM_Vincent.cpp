@@ -0,0 +1,237 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
+
+using namespace std;
+
+/*
+*	Depression filling as grayscale reconstruction by erosion, with the fast
+*	hybrid algorithm of Vincent (1993). The marker starts at the DEM on the
+*	outlets, the cells the Init* functions seed (next to NoData or the edge
+*	of the grid), and at +infinity elsewhere; the DEM is the mask. A forward
+*	and a backward raster scan erode the marker down to the mask, each cell
+*	taking max(mask, min(marker, scanned neighbours)), and the backward
+*	scan queues the cells that can still lower a neighbour. A FIFO then
+*	propagates from these cells as long as anything changes. P&D runs the
+*	same erosion, but repeats whole scans until nothing changes.
+*
+*	Both grids are padded by one cell at +infinity, as are NoData cells,
+*	which leaves every minimum unchanged, so the scans need no bounds or
+*	NoData checks. Within a row only the left (right) neighbour is a
+*	recurrence; the row above (below) is taken first in a separate loop the
+*	compiler can vectorize. The output is that of the Priority-Flood engines.
+*/
+
+//the marker eroded down to the mask (the DEM), both padded by one cell, kept
+//in the workspace between fills
+struct VincentState : public EngineState
+{
+	std::vector<float, LargeAllocator<float> > marker;
+	std::vector<float, LargeAllocator<float> > mask;
+};
+
+template <class NB>
+static void ForwardScan(float* marker, const float* mask, int width, int height, ProgressSink& progress, long long& count)
+{
+	PhaseSpan span("forward scan");
+	size_t stride = (size_t)width + 2;
+	for (int row = 1; row <= height; row++)
+	{
+		float* f = marker + row * stride;
+		const float* g = mask + row * stride;
+		const float* up = f - stride;
+		for (int col = 1; col <= width; col++)
+		{
+			float m = up[col];
+			if (NB::Count == 8) m = std::min(m, std::min(up[col - 1], up[col + 1]));
+			f[col] = std::max(g[col], std::min(f[col], m));
+		}
+		for (int col = 1; col <= width; col++) f[col] = std::max(g[col], std::min(f[col], f[col - 1]));
+		count += width;
+		if (!progress.Poll(count)) return;
+	}
+}
+
+//also queues every cell whose final marker is below a scanned neighbour
+//that can still be lowered
+template <class NB>
+static void BackwardScan(float* marker, const float* mask, int width, int height, NodeQueue& queue, ProgressSink& progress, long long& count)
+{
+	PhaseSpan span("backward scan");
+	size_t stride = (size_t)width + 2;
+	for (int row = height; row >= 1; row--)
+	{
+		float* f = marker + row * stride;
+		const float* g = mask + row * stride;
+		const float* down = f + stride;
+		const float* gDown = g + stride;
+		for (int col = 1; col <= width; col++)
+		{
+			float m = down[col];
+			if (NB::Count == 8) m = std::min(m, std::min(down[col - 1], down[col + 1]));
+			f[col] = std::max(g[col], std::min(f[col], m));
+		}
+		for (int col = width; col >= 1; col--) f[col] = std::max(g[col], std::min(f[col], f[col + 1]));
+		for (int col = 1; col <= width; col++)
+		{
+			float z = f[col];
+			bool lowers = (f[col + 1] > z && f[col + 1] > g[col + 1]) || (down[col] > z && down[col] > gDown[col]);
+			if (NB::Count == 8)
+			{
+				lowers = lowers || (down[col - 1] > z && down[col - 1] > gDown[col - 1]) ||
+					(down[col + 1] > z && down[col + 1] > gDown[col + 1]);
+			}
+			if (lowers)
+			{
+				Node node;
+				node.row = row - 1;
+				node.col = col - 1;
+				node.spill = z;
+				queue.push(node);
+			}
+		}
+		count += width;
+		if (!progress.Poll(count)) return;
+	}
+}
+
+//lowers the neighbours of queued cells until the marker is stable
+template <class NB>
+static void PropagateQueue(float* marker, const float* mask, int width, NodeQueue& queue, ProgressSink& progress, long long& count)
+{
+	PhaseSpan span("queue");
+	size_t stride = (size_t)width + 2;
+	while (!queue.empty())
+	{
+		Node node = queue.front();
+		queue.pop();
+		count++;
+		if (!progress.Poll(count)) return;
+		float z = marker[(node.row + 1) * stride + node.col + 1];
+		for (int i = 0; i < NB::Count; i++)
+		{
+			int iRow = Get_rowTo<NB>(i, node.row);
+			int iCol = Get_colTo<NB>(i, node.col);
+			size_t q = (iRow + 1) * stride + iCol + 1;
+			if (marker[q] > z && marker[q] != mask[q])
+			{
+				marker[q] = std::max(z, mask[q]);
+				Node next;
+				next.row = iRow;
+				next.col = iCol;
+				next.spill = marker[q];
+				queue.push(next);
+			}
+		}
+	}
+}
+
+template <class NB>
+static int FillDEM_Vincent_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	PhaseSpan run("FillDEM_Vincent");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	CDEM& dem = workspace->dem;
+	double geoTransformArgs[6];
+	cout << "Reading tiff file..." << endl;
+	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
+	{
+		printf("Error occurred while reading GeoTIFF file!\n");
+		return 0;
+	}
+
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	cout << "DEM Width:" << width << "  Height:" << height << endl;
+
+	cout << "Using the fast hybrid reconstruction of Vincent (1993)" << endl;
+
+	if (!workspace->Prepare(width, height)) {
+		printf("Failed to allocate memory!\n");
+		return 0;
+	}
+	size_t stride = (size_t)width + 2;
+	const float infinity = std::numeric_limits<float>::infinity();
+	VincentState* state = workspace->GetEngineState<VincentState>();
+	state->marker.assign(stride * (height + 2), infinity);
+	state->mask.assign(stride * (height + 2), infinity);
+	float* marker = &state->marker[0];
+	float* mask = &state->mask[0];
+	NodeQueue& queue = workspace->depressionQue;
+
+	cout << "\nStart filling depressions..." << endl;
+	PhaseSpan fillSpan("fill");
+
+	// the DEM on the outlets, +infinity elsewhere
+	PhaseSpan seedSpan("border seeding");
+	for (int row = 0; row < height; row++)
+	{
+		for (int col = 0; col < width; col++)
+		{
+			if (!dem.is_Valid(row, col)) continue;
+			size_t p = (row + 1) * stride + col + 1;
+			mask[p] = dem.asFloat(row, col);
+			for (int i = 0; i < NB::Count; i++)
+			{
+				if (!dem.is_Valid(Get_rowTo<NB>(i, row), Get_colTo<NB>(i, col)))
+				{
+					marker[p] = mask[p];
+					break;
+				}
+			}
+		}
+	}
+	seedSpan.End();
+	//the two scans; the queue adds what it takes
+	progress->SetTotal(2LL * width * height);
+
+	long long count = 0;
+	ForwardScan<NB>(marker, mask, width, height, *progress, count);
+	if (!progress->Stopped()) BackwardScan<NB>(marker, mask, width, height, queue, *progress, count);
+	long long queued = queue.size();
+	if (!progress->Stopped()) PropagateQueue<NB>(marker, mask, width, queue, *progress, count);
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		return false;
+	}
+
+	PhaseSpan writeSpan("write filled values");
+	for (int row = 0; row < height; row++)
+	{
+		const float* f = marker + (row + 1) * stride + 1;
+		const float* g = mask + (row + 1) * stride + 1;
+		for (int col = 0; col < width; col++)
+		{
+			if (f[col] != g[col]) dem.Set_Value(row, col, f[col]);
+		}
+	}
+	writeSpan.End();
+	double consumeTime = fillSpan.End();
+	cout << "\nTime used:" << consumeTime << " seconds" << endl;
+	cout << "Cells queued by the backward scan: " << queued << endl;
+
+	double min, max, mean, stdDev;
+	calculateStatistics(dem, &min, &max, &mean, &stdDev);
+	return workspace->WriteOutput(outputFilledPath, geoTransformArgs,
+		&min, &max, &mean, &stdDev, -9999);
+}
+
+int FillDEM_Vincent(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		return FillDEM_Vincent_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	return FillDEM_Vincent_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
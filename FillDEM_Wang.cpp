@@ -6,6 +6,9 @@
 #include "dem.h" // DEMصͷļ  
 #include "Node.h" // ڵͷļ  
 #include "utils.h" // ߺͷļ  
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
 #include <time.h> // ʱ䴦ͷļ  
 #include <list> // ˫⣨Ȼδδֱʹã  
 #include <stack> // ջ⣨Ȼδδֱʹã  
@@ -13,20 +16,54 @@
 
 using namespace std; // ʹñ׼ռ  
 
-// Node  
-typedef std::vector<Node> NodeVector;
-// ȼУʹNodeΪԪأNodeVectorΪײNode::GreaterΪȽϺ  
-typedef std::priority_queue<Node, NodeVector, Node::Greater> PriorityQueue;
 
-int FillDEM_Wang(const char* inputFile, const char* outputFilledPath)
+//floods the unprocessed neighbours of (row, col); interior cells skip the bounds checks
+template <class NB, bool Interior>
+static void ProcessNeighbours_Wang(CDEM& dem, Flag& flag, PriorityQueue& queue, int row, int col, float spill)
 {
-	CDEM dem;
+	int iRow, iCol;
+	float iSpill;
+	Node tmpNode;
+	for (int i = 0; i < NB::Count; i++)
+	{
+		iRow = Get_rowTo<NB>(i, row);
+		iCol = Get_colTo<NB>(i, col);
+
+		// ھӵԪδ
+		if (!flag.IsProcessedAt<Interior>(iRow, iCol))
+		{
+			// ȡھӵԪֵ
+			iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill <= spill)
+			{
+				iSpill = spill;
+			}
+			dem.Set_Value(iRow, iCol, iSpill);
+			flag.SetFlag(iRow, iCol);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = iSpill;
+			queue.push(tmpNode);
+		}
+
+	}
+}
+
+template <class NB>
+static int FillDEM_Wang_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	PhaseSpan run("FillDEM_Wang");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	CDEM& dem = workspace->dem;
 	// һ洢任
 	double geoTransformArgs[6];
 	double noDataValue = 0.0;
 	cout << "Reading tiff file..." << endl;
 	// ȡTIFFļDEMУʧϢ0
-	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
+	if (!workspace->ReadInput(inputFile, geoTransformArgs))
 	{
 		cout << "error!" << endl;
 		return 0;
@@ -37,64 +74,66 @@ int FillDEM_Wang(const char* inputFile, const char* outputFilledPath)
 	cout << "DEM Width:" << width << "  Height:" << height << endl;
 
 	// һ־ڱDEMеԪǷѴ
-	Flag flag;
-	if (!flag.Init(width, height)) {
+	if (!workspace->Prepare(width, height)) {
 		printf("Failed to allocate memory!\n");
 		return 0;
 	}
+	Flag& flag = workspace->flag;
+	Checkpointer& checkpoint = workspace->checkpoint;
 
 
 	cout << "Using Wang & Liu (2006) method to fill DEM" << endl;
-	time_t timeStart, timeEnd;
-	timeStart = time(NULL);
+	PhaseSpan fillSpan("fill");
 
-	PriorityQueue queue;
+	PriorityQueue& queue = workspace->priorityQueue;
 	// ЧԪؼ
-	int validElementsCount = 0;
-	// push border cells into the PQ
-	for (int row = 0; row < height; row++)
+	long long validElementsCount = 0;
+	long long count = 0;
+	if (checkpoint.Resuming()) workspace->RestoreCheckpoint(count, validElementsCount);
+	else
 	{
-		for (int col = 0; col < width; col++)
+		// push border cells into the PQ
+		PhaseSpan seedSpan("border seeding");
+		for (int row = 0; row < height; row++)
 		{
-			Node tmpNode;
-			if (!dem.is_NoData(row, col))
+			for (int col = 0; col < width; col++)
 			{
-				validElementsCount++;
-				for (int i = 0; i < 8; i++)
+				Node tmpNode;
+				if (dem.is_Valid(row, col))
 				{
-					int iRow, iCol;
-					iRow = Get_rowTo(i, row);
-					iCol = Get_colTo(i, col);
-					if (!dem.is_InGrid(iRow, iCol) || dem.is_NoData(iRow, iCol))
+					validElementsCount++;
+					for (int i = 0; i < NB::Count; i++)
 					{
-						tmpNode.col = col;
-						tmpNode.row = row;
-						tmpNode.spill = dem.asFloat(row, col);
-						queue.push(tmpNode);
-						flag.SetFlag(row, col);
-						break;
+						int iRow, iCol;
+						iRow = Get_rowTo<NB>(i, row);
+						iCol = Get_colTo<NB>(i, col);
+						if (!dem.is_Valid(iRow, iCol))
+						{
+							tmpNode.col = col;
+							tmpNode.row = row;
+							tmpNode.spill = dem.asFloat(row, col);
+							queue.push(tmpNode);
+							flag.SetFlag(row, col);
+							break;
+						}
 					}
 				}
-			}
-			else
-			{
-				flag.SetFlag(row, col);
+				else
+				{
+					flag.SetFlag(row, col);
+				}
 			}
 		}
+		seedSpan.End();
 	}
-	int percentFive = validElementsCount / 20;
+	progress->SetTotal(validElementsCount);
+	checkpoint.Start("wang", NB::Count, geoTransformArgs, validElementsCount, count);
 
-	int count = 0;
-	int iRow, iCol;
-	float iSpill;
 	while (!queue.empty())
 	{
+		if (checkpoint.Due(count)) workspace->SaveCheckpoint(count);
 		count++;
-		if (count % percentFive == 0)
-		{
-			int percentNum = count / percentFive;
-			cout << "Progress:" << percentNum * 5 << "%\r";
-		}
+		if (!progress->Poll(count)) break;
 		Node tmpNode = queue.top();
 		queue.pop();
 
@@ -103,40 +142,33 @@ int FillDEM_Wang(const char* inputFile, const char* outputFilledPath)
 		float spill = tmpNode.spill;
 
 
-		for (int i = 0; i < 8; i++)
-		{
-			iRow = Get_rowTo(i, row);
-			iCol = Get_colTo(i, col);
-
-			// ھӵԪδ
-			if (!flag.IsProcessed(iRow, iCol))
-			{
-				// ȡھӵԪֵ
-				iSpill = dem.asFloat(iRow, iCol);
-				if (iSpill <= spill)
-				{
-					iSpill = spill;
-				}
-				dem.Set_Value(iRow, iCol, iSpill);
-				flag.SetFlag(iRow, iCol);
-				tmpNode.row = iRow;
-				tmpNode.col = iCol;
-				tmpNode.spill = iSpill;
-				queue.push(tmpNode);
-			}
-
-		}
+		if (IsInterior(row, col, width, height)) ProcessNeighbours_Wang<NB, true>(dem, flag, queue, row, col, spill);
+		else ProcessNeighbours_Wang<NB, false>(dem, flag, queue, row, col, spill);
 
 	}
-	timeEnd = time(NULL);
-	double consumeTime = difftime(timeEnd, timeStart);
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		//the cell of the last count was not taken yet
+		if (checkpoint.Enabled() && workspace->SaveCheckpoint(count - 1, true))
+			cout << "Checkpoint written to " << checkpoint.GetPath() << endl;
+		return 0;
+	}
+	checkpoint.Finish(true);
+	double consumeTime = fillSpan.End();
 	cout << "Time used:" << consumeTime << " seconds" << endl;
 
 	// ͳļ  
 	double min, max, mean, stdDev;
 	calculateStatistics(dem, &min, &max, &mean, &stdDev);
-	CreateGeoTIFF(outputFilledPath, dem.Get_NY(), dem.Get_NX(),
-		(void*)dem.getDEMdata(), GDALDataType::GDT_Float32, geoTransformArgs,
+	return workspace->WriteOutput(outputFilledPath, geoTransformArgs,
 		&min, &max, &mean, &stdDev, -9999);
-	return 1;
-}
\ No newline at end of file
+}
+
+int FillDEM_Wang(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		return FillDEM_Wang_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	return FillDEM_Wang_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
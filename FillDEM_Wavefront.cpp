@@ -0,0 +1,215 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
+#include "ParallelTrace.h"
+
+using namespace std;
+
+/*
+*	Level-synchronous Priority-Flood. The flood only has to respect the order
+*	of distinct spill levels: every cell reached from the lowest level L with
+*	an elevation at or below L ends at L, whatever order the cells of the
+*	level are taken in. So all nodes at L are popped from the PQ at once and
+*	the level is flooded like the pitque of Barnes et al. (2014). A level
+*	front of at least minFront cells is expanded on the TracePool workers,
+*	which claim cells with atomic flags and keep the cells above L in their
+*	own spill lists for the PQ; the raised cells are written once the level
+*	is done, so the kernel never writes the DEM. The output is that of the
+*	serial engines. Quantized DEMs, where whole terraces share one level,
+*	gain the most.
+*/
+
+//one cell of a level front; cells at or below the level are traced on,
+//the others become spill cells of the next levels
+template <class NB>
+class WavefrontKernel : public TraceKernel
+{
+public:
+	const CDEM& dem;
+	Flag& flag;
+	WavefrontKernel(const CDEM& dem, Flag& flag) : dem(dem), flag(flag) {}
+	virtual void Expand(const Node& node, TraceWorker& worker)
+	{
+		Node N;
+		for (int i = 0; i < NB::Count; i++)
+		{
+			int iRow = Get_rowTo<NB>(i, node.row);
+			int iCol = Get_colTo<NB>(i, node.col);
+			//outside the grid; NoData cells are flagged already
+			if (!dem.is_Valid(iRow, iCol)) continue;
+			if (!flag.ClaimFlag(iRow, iCol)) continue;
+			N.row = iRow;
+			N.col = iCol;
+			float iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill <= node.spill)
+			{
+				N.spill = node.spill;
+				worker.Push(N);
+				worker.Potential(N);
+			}
+			else
+			{
+				N.spill = iSpill;
+				worker.Spill(N);
+			}
+		}
+	}
+};
+
+//serial expansion of one cell of the level front
+template <class NB, bool Interior>
+static void ProcessNeighbours_Wavefront(CDEM& dem, Flag& flag, PriorityQueue& queue, NodeQueue& front, int row, int col, float spill)
+{
+	Node tmpNode;
+	for (int i = 0; i < NB::Count; i++)
+	{
+		int iRow = Get_rowTo<NB>(i, row);
+		int iCol = Get_colTo<NB>(i, col);
+		if (flag.IsProcessedAt<Interior>(iRow, iCol)) continue;
+		flag.SetFlag(iRow, iCol);
+		tmpNode.row = iRow;
+		tmpNode.col = iCol;
+		float iSpill = dem.asFloat(iRow, iCol);
+		if (iSpill <= spill)
+		{
+			dem.Set_Value(iRow, iCol, spill);
+			tmpNode.spill = spill;
+			front.push(tmpNode);
+		}
+		else
+		{
+			tmpNode.spill = iSpill;
+			queue.push(tmpNode);
+		}
+	}
+}
+
+template <class NB>
+static int FillDEM_Wavefront_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	PhaseSpan run("FillDEM_Wavefront");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	CDEM& dem = workspace->dem;
+	double geoTransformArgs[6];
+	cout << "Reading tiff file..." << endl;
+	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
+	{
+		printf("Error occurred while reading GeoTIFF file!\n");
+		return 0;
+	}
+
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	cout << "DEM Width:" << width << "  Height:" << height << endl;
+
+	TracePool& tracePool = workspace->tracePool;
+	cout << "Using level-synchronous wavefront flooding on " << tracePool.GetThreads() << " threads" << endl;
+
+	if (!workspace->Prepare(width, height)) {
+		printf("Failed to allocate memory!\n");
+		return 0;
+	}
+	Flag& flag = workspace->flag;
+
+	cout << "\nStart filling depressions..." << endl;
+	PhaseSpan fillSpan("fill");
+
+	PriorityQueue& queue = workspace->priorityQueue;
+	NodeQueue& front = workspace->depressionQue;
+	long long validElementsCount = 0;
+	// push border cells into the PQ
+	PhaseSpan seedSpan("border seeding");
+	for (int row = 0; row < height; row++)
+	{
+		for (int col = 0; col < width; col++)
+		{
+			if (!dem.is_Valid(row, col))
+			{
+				flag.SetFlag(row, col);
+				continue;
+			}
+			validElementsCount++;
+			for (int i = 0; i < NB::Count; i++)
+			{
+				if (!dem.is_Valid(Get_rowTo<NB>(i, row), Get_colTo<NB>(i, col)))
+				{
+					Node tmpNode;
+					tmpNode.row = row;
+					tmpNode.col = col;
+					tmpNode.spill = dem.asFloat(row, col);
+					queue.push(tmpNode);
+					flag.SetFlag(row, col);
+					break;
+				}
+			}
+		}
+	}
+	seedSpan.End();
+	progress->SetTotal(validElementsCount);
+
+	long long count = 0;
+	long long levels = 0;
+	long long parallelLevels = 0;
+	while (!queue.empty() && !progress->Stopped())
+	{
+		//the whole front at the lowest level; hasAt does not look past it,
+		//since the level still pushes cells below the next one
+		float level = queue.top().spill;
+		do
+		{
+			front.push(queue.top());
+			queue.pop();
+		} while (queue.hasAt(level));
+		levels++;
+		while (!front.empty())
+		{
+			if (front.size() >= tracePool.GetMinFront() && tracePool.Usable(dem, flag))
+			{
+				WavefrontKernel<NB> kernel(dem, flag);
+				count += tracePool.Run(kernel, front, *progress, count);
+				const vector<Node>& raised = tracePool.GetPotentialCells();
+				for (size_t k = 0; k < raised.size(); k++) dem.Set_Value(raised[k].row, raised[k].col, level);
+				const vector<Node>& spillCells = tracePool.GetSpillCells();
+				for (size_t k = 0; k < spillCells.size(); k++) queue.push(spillCells[k]);
+				parallelLevels++;
+				break;
+			}
+			Node tmpNode = front.front();
+			front.pop();
+			count++;
+			if (!progress->Poll(count)) break;
+			if (IsInterior(tmpNode.row, tmpNode.col, width, height)) ProcessNeighbours_Wavefront<NB, true>(dem, flag, queue, front, tmpNode.row, tmpNode.col, level);
+			else ProcessNeighbours_Wavefront<NB, false>(dem, flag, queue, front, tmpNode.row, tmpNode.col, level);
+		}
+	}
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		return false;
+	}
+	double consumeTime = fillSpan.End();
+	cout << "\nTime used:" << consumeTime << " seconds" << endl;
+	cout << "Levels: " << levels << "  expanded in parallel: " << parallelLevels << endl;
+
+	double min, max, mean, stdDev;
+	calculateStatistics(dem, &min, &max, &mean, &stdDev);
+	return workspace->WriteOutput(outputFilledPath, geoTransformArgs,
+		&min, &max, &mean, &stdDev, -9999);
+}
+
+int FillDEM_Wavefront(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		return FillDEM_Wavefront_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	return FillDEM_Wavefront_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
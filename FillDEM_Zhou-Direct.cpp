@@ -6,24 +6,25 @@
 #include "dem.h"
 #include "Node.h"
 #include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
 #include <time.h>
 #include <list>
 #include <stack>
 #include <unordered_map>
 using namespace std;
 
-//ͱNodeVector  Node PriorityQueue һȶУ
-//ʹ Node 󲢰 Node::Greater 򣨿ǰֵ߳򣩡
-typedef std::vector<Node> NodeVector;
-typedef std::priority_queue<Node, NodeVector, Node::Greater> PriorityQueue;
 // ʼȼеĺ
 // һDEMһ־У׷ٶкȶУԼһڽȼĲ
-void InitPriorityQue_Direct(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& percentFive)
+template <class NB>
+void InitPriorityQue_Direct(CDEM& dem, Flag& flag, NodeQueue& traceQueue, PriorityQueue& priorityQueue, ProgressSink& progress)
 {
+	PhaseSpan span("border seeding");
 	//ȡDEMĿȺ͸߶ȣʼЧԪؼʱڵ
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
-	int validElementsCount = 0;
+	long long validElementsCount = 0;
 	Node tmpNode;
 	int iRow, iCol;
 	//push border cells into the PQ
@@ -32,15 +33,15 @@ void InitPriorityQue_Direct(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Prio
 	{
 		for (int col = 0; col < width; col++)
 		{
-			if (!dem.is_NoData(row, col))
+			if (dem.is_Valid(row, col))
 			{
 				validElementsCount++;
-				for (int i = 0; i < 8; i++)
+				for (int i = 0; i < NB::Count; i++)
 				{
-					iRow = Get_rowTo(i, row);
-					iCol = Get_colTo(i, col);
+					iRow = Get_rowTo<NB>(i, row);
+					iCol = Get_colTo<NB>(i, col);
 					//ھǱ߽ݵԪ򽫵ǰԪΪ߽絥ԪȶС
-					if (!dem.is_InGrid(iRow, iCol) || dem.is_NoData(iRow, iCol))
+					if (!dem.is_Valid(iRow, iCol))
 					{
 						tmpNode.col = col;
 						tmpNode.row = row;
@@ -58,32 +59,75 @@ void InitPriorityQue_Direct(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Prio
 		}
 	}
 	//ڽȸµֵ
-	percentFive = validElementsCount / 20;
+	progress.SetTotal(validElementsCount);
 }
 //׷ٶеĽڵ㣬ȶкͼ
-void ProcessTraceQue_Direct(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& count, int percentFive)
+template <class NB>
+class DirectTraceKernel : public TraceKernel
+{
+public:
+	CDEM& dem;
+	Flag& flag;
+	DirectTraceKernel(CDEM& dem, Flag& flag) : dem(dem), flag(flag) {}
+	//one step of ProcessTraceQue_Direct with atomic flags
+	virtual void Expand(const Node& node, TraceWorker& worker)
+	{
+		bool bInPQ = false;
+		Node N;
+		for (int i = 0; i < NB::Count; i++)
+		{
+			int iRow = Get_rowTo<NB>(i, node.row);
+			int iCol = Get_colTo<NB>(i, node.col);
+			if (flag.IsProcessedAtomic(iRow, iCol)) continue;
+			float iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill <= node.spill) {
+				if (!bInPQ) {
+					worker.Spill(node);
+					bInPQ = true;
+				}
+				continue;
+			}
+			//another worker may have claimed N in the meantime
+			if (!flag.ClaimFlag(iRow, iCol)) continue;
+			N.col = iCol;
+			N.row = iRow;
+			N.spill = iSpill;
+			worker.Push(N);
+		}
+	}
+};
+
+template <class NB>
+void ProcessTraceQue_Direct(CDEM& dem, Flag& flag, NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress, TracePool& tracePool)
 {
 	int iRow, iCol, i;
 	float iSpill;//ڻȡָλõĸֵ߳
 	Node N, node, headNode;
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
-	int total = 0, nPSC = 0;//ʼܴڵȶĽڵ
+	long long total = 0, nPSC = 0;//ʼܴڵȶĽڵ
 	bool bInPQ = false;//ǵǰڵǷѱӵȼ
 	while (!traceQueue.empty())
 	{
+		if (traceQueue.size() >= tracePool.GetMinFront() && tracePool.Usable(dem, flag))
+		{
+			//a large front: trace the rest of it on all workers
+			DirectTraceKernel<NB> kernel(dem, flag);
+			total += tracePool.Run(kernel, traceQueue, progress, count + total);
+			const vector<Node>& spillCells = tracePool.GetSpillCells();
+			for (size_t k = 0; k < spillCells.size(); k++) priorityQueue.push(spillCells[k]);
+			nPSC += spillCells.size();
+			break;
+		}
 		node = traceQueue.front();
 		traceQueue.pop();
 		total++;
-		if ((count + total) % percentFive == 0)
-		{
-			std::cout << "Progress" << (count + total) / percentFive * 5 << "%\r";
-		}
+		progress.Poll(count + total);
 		bInPQ = false;
-		for (i = 0; i < 8; i++)
+		for (i = 0; i < NB::Count; i++)
 		{
-			iRow = Get_rowTo(i, node.row);// ݵǰͽڵλüĿ
-			iCol = Get_colTo(i, node.col);// ݵǰͽڵλüĿ
+			iRow = Get_rowTo<NB>(i, node.row);// ݵǰͽڵλüĿ
+			iCol = Get_colTo<NB>(i, node.col);// ݵǰͽڵλüĿ
 			// ĿλѾ
 			if (flag.IsProcessedDirect(iRow, iCol)) continue;
 
@@ -113,7 +157,8 @@ void ProcessTraceQue_Direct(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Prio
 	count += total - nPSC;
 }
 
-void ProcessPit_Direct(CDEM& dem, Flag& flag, queue<Node>& depressionQue, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& count, int percentFive)
+template <class NB>
+void ProcessPit_Direct(CDEM& dem, Flag& flag, NodeQueue& depressionQue, NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress)
 {
 	int iRow, iCol, i;
 	float iSpill;
@@ -126,14 +171,11 @@ void ProcessPit_Direct(CDEM& dem, Flag& flag, queue<Node>& depressionQue, queue<
 		node = depressionQue.front();
 		depressionQue.pop();
 		count++;
-		if (count % percentFive == 0)
+		progress.Poll(count);
+		for (i = 0; i < NB::Count; i++)
 		{
-			std::cout << "Progress:" << count / percentFive * 5 << "%\r";
-		}
-		for (i = 0; i < 8; i++)
-		{
-			iRow = Get_rowTo(i, node.row);
-			iCol = Get_colTo(i, node.col);
+			iRow = Get_rowTo<NB>(i, node.row);
+			iCol = Get_colTo<NB>(i, node.col);
 
 			if (flag.IsProcessedDirect(iRow, iCol)) continue;
 			iSpill = dem.asFloat(iRow, iCol);
@@ -162,14 +204,60 @@ void ProcessPit_Direct(CDEM& dem, Flag& flag, queue<Node>& depressionQue, queue<
 		}
 	}
 }
+//handles the unprocessed neighbours of a cell taken from the PQ; interior cells skip the bounds checks
+template <class NB, bool Interior>
+static void ProcessNeighbours_Direct(CDEM& dem, Flag& flag, NodeQueue& depressionQue, NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress, TracePool& tracePool, int row, int col, float spill)
+{
+	int iRow, iCol;
+	float iSpill;
+	Node tmpNode;
+	for (int i = 0; i < NB::Count; i++)
+	{
+
+		iRow = Get_rowTo<NB>(i, row);
+		iCol = Get_colTo<NB>(i, col);
+
+		if (flag.IsProcessedAt<Interior>(iRow, iCol)) continue;
+
+		iSpill = dem.asFloat(iRow, iCol);
+		if (iSpill <= spill)
+		{
+			//depression cell
+			dem.Set_Value(iRow, iCol, spill);
+			flag.SetFlag(iRow, iCol);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = spill;
+			depressionQue.push(tmpNode);
+			ProcessPit_Direct<NB>(dem, flag, depressionQue, traceQueue, priorityQueue, count, progress);
+		}
+		else
+		{
+			//slope cell
+			flag.SetFlag(iRow, iCol);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = iSpill;
+			traceQueue.push(tmpNode);
+		}
+		ProcessTraceQue_Direct<NB>(dem, flag, traceQueue, priorityQueue, count, progress, tracePool);
+	}
+}
+
 //ڶȡDEMļݵأ
-void FillDEM_Zhou_Direct(const char* inputFile, const char* outputFilledPath)
+template <class NB>
+static void FillDEM_Zhou_Direct_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
 {
-	queue<Node> traceQueue;
-	queue<Node> depressionQue;
+	PhaseSpan run("FillDEM_Zhou_Direct");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	NodeQueue& traceQueue = workspace->traceQueue;
+	NodeQueue& depressionQue = workspace->depressionQue;
 
 	//read float-type DEM
-	CDEM dem;
+	CDEM& dem = workspace->dem;
 	double geoTransformArgs[6];
 	std::cout << "Reading tiff files..." << endl;
 	//ȡGeoTIFFʽDEMļ
@@ -181,81 +269,59 @@ void FillDEM_Zhou_Direct(const char* inputFile, const char* outputFilledPath)
 
 	std::cout << "Finish reading DEM file." << endl;
 
-	time_t timeStart, timeEnd;
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
 
-	timeStart = time(NULL);
+	PhaseSpan fillSpan("fill");
 	std::cout << "Using the direction implementation of the proposed variant to fill DEM" << endl;
 
-	Flag flag;
-	if (!flag.Init(width, height)) {
+	if (!workspace->Prepare(width, height)) {
 		printf("Failed to allocate memory!\n");
 		return;
 	}
+	Flag& flag = workspace->flag;
 
-	PriorityQueue priorityQueue;
-	int percentFive;
-	int count = 0, potentialSpillCount = 0;
-	int iRow, iCol, row, col;
-	float iSpill, spill;
+	PriorityQueue& priorityQueue = workspace->priorityQueue;
+	long long count = 0, potentialSpillCount = 0;
+	int row, col;
+	float spill;
 
 	//ʼȶ
-	InitPriorityQue_Direct(dem, flag, traceQueue, priorityQueue, percentFive);
+	InitPriorityQue_Direct<NB>(dem, flag, traceQueue, priorityQueue, *progress);
 	while (!priorityQueue.empty())
 	{
 		Node tmpNode = priorityQueue.top();
 		priorityQueue.pop();
 		count++;
-		if (count % percentFive == 0)
-		{
-			std::cout << "Progress:" << count / percentFive * 5 << "%\r";
-		}
+		if (!progress->Poll(count)) break;
 		row = tmpNode.row;
 		col = tmpNode.col;
 		spill = tmpNode.spill;
-		for (int i = 0; i < 8; i++)
-		{
-
-			iRow = Get_rowTo(i, row);
-			iCol = Get_colTo(i, col);
-
-			if (flag.IsProcessed(iRow, iCol)) continue;
-
-			iSpill = dem.asFloat(iRow, iCol);
-			if (iSpill <= spill)
-			{
-				//depression cell
-				dem.Set_Value(iRow, iCol, spill);
-				flag.SetFlag(iRow, iCol);
-				tmpNode.row = iRow;
-				tmpNode.col = iCol;
-				tmpNode.spill = spill;
-				depressionQue.push(tmpNode);
-				ProcessPit_Direct(dem, flag, depressionQue, traceQueue, priorityQueue, count, percentFive);
-			}
-			else
-			{
-				//slope cell
-				flag.SetFlag(iRow, iCol);
-				tmpNode.row = iRow;
-				tmpNode.col = iCol;
-				tmpNode.spill = iSpill;
-				traceQueue.push(tmpNode);
-			}
-			ProcessTraceQue_Direct(dem, flag, traceQueue, priorityQueue, count, percentFive);
-		}
+		if (IsInterior(row, col, width, height)) ProcessNeighbours_Direct<NB, true>(dem, flag, depressionQue, traceQueue, priorityQueue, count, *progress, workspace->tracePool, row, col, spill);
+		else ProcessNeighbours_Direct<NB, false>(dem, flag, depressionQue, traceQueue, priorityQueue, count, *progress, workspace->tracePool, row, col, spill);
+	}
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		return;
 	}
-	timeEnd = time(NULL);
-	double consumeTime = difftime(timeEnd, timeStart);
+	double consumeTime = fillSpan.End();
 	std::cout << "Time used:" << consumeTime << " seconds" << endl;
 	double min, max, mean, stdDev;
 	//DEMͳϢСֵֵƽֵ׼
 	calculateStatistics(dem, &min, &max, &mean, &stdDev);
 
 	//DEMݱΪGeoTIFFʽļ
-	CreateGeoTIFF(outputFilledPath, dem.Get_NY(), dem.Get_NX(),
-		(void*)dem.getDEMdata(), GDALDataType::GDT_Float32, geoTransformArgs,
+	workspace->WriteOutput(outputFilledPath, geoTransformArgs,
 		&min, &max, &mean, &stdDev, -9999);
 	return;
 }
+
+void FillDEM_Zhou_Direct(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		FillDEM_Zhou_Direct_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	else
+		FillDEM_Zhou_Direct_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
@@ -6,19 +6,22 @@
 #include "dem.h"
 #include "Node.h"
 #include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
 #include <time.h>
 #include <list>
 #include <unordered_map>
 using namespace std;
 
-typedef std::vector<Node> NodeVector;
-typedef std::priority_queue<Node, NodeVector, Node::Greater> PriorityQueue;
 // ʼȶк׷ٶе
-void InitPriorityQue(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& percentFive)
+template <class NB>
+void InitPriorityQue(CDEM& dem, Flag& flag, Flag& flag2, NodeQueue& traceQueue, PriorityQueue& priorityQueue, ProgressSink& progress)
 {
+	PhaseSpan span("border seeding");
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
-	int validElementsCount = 0;
+	long long validElementsCount = 0;
 	Node tmpNode;
 	int iRow, iCol;
 	// push border cells into the PQ
@@ -26,15 +29,15 @@ void InitPriorityQue(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& traceQueue
 	{
 		for (int col = 0; col < width; col++)
 		{
-			if (!dem.is_NoData(row, col))
+			if (dem.is_Valid(row, col))
 			{
 				validElementsCount++;
 
-				for (int i = 0; i < 8; i++)
+				for (int i = 0; i < NB::Count; i++)
 				{
-					iRow = Get_rowTo(i, row);
-					iCol = Get_colTo(i, col);
-					if (!dem.is_InGrid(iRow, iCol) || dem.is_NoData(iRow, iCol))
+					iRow = Get_rowTo<NB>(i, row);
+					iCol = Get_colTo<NB>(i, col);
+					if (!dem.is_Valid(iRow, iCol))
 					{
 						tmpNode.col = col;
 						tmpNode.row = row;
@@ -52,32 +55,34 @@ void InitPriorityQue(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& traceQueue
 		}
 	}
 
-	percentFive = validElementsCount / 20;
+	progress.SetTotal(validElementsCount);
 }
 // ׷ٶеĽڵ㣬DEMݣά־
-void ProcessTraceQue(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& count, int percentFive)
+template <class NB>
+void ProcessTraceQue(CDEM& dem, Flag& flag, Flag& flag2, NodeQueue& traceQueue, NodeQueue& traceQueue2, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress)
 {
 	int iRow, iCol, i;
 	float iSpill;
 	Node N, node, headNode;
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
-	queue<Node> traceQueue2(traceQueue);
-	int total = 0;
+	//the nodes initially in traceQueue seed the second pass; they are
+	//collected while the first pass pops them instead of copying the queue
+	size_t seeds = traceQueue.size();
+	traceQueue2.clear();
+	long long total = 0;
 	while (!traceQueue.empty())
 	{
 		node = traceQueue.front();
 		traceQueue.pop();
+		if ((size_t)total < seeds) traceQueue2.push(node);
 		total++;
-		if ((count + total / 2) % percentFive == 0)
-		{
-			std::cout << "Progress:" << (count + total / 2) / percentFive * 5 << "%\r";
-		}
+		progress.Poll(count + total / 2);
 
-		for (i = 0; i < 8; i++)
+		for (i = 0; i < NB::Count; i++)
 		{
-			iRow = Get_rowTo(i, node.row);
-			iCol = Get_colTo(i, node.col);
+			iRow = Get_rowTo<NB>(i, node.row);
+			iCol = Get_colTo<NB>(i, node.col);
 			if (flag.IsProcessedDirect(iRow, iCol)) continue;
 
 			iSpill = dem.asFloat(iRow, iCol);
@@ -93,8 +98,8 @@ void ProcessTraceQue(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& traceQueue
 			flag.SetFlag(iRow, iCol);
 		}
 	}
-	int nPSC = 0;
-	int count0 = count;
+	long long nPSC = 0;
+	long long count0 = count;
 	count += total / 2;
 	total = 0;
 	bool bInPQ = false;
@@ -103,16 +108,13 @@ void ProcessTraceQue(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& traceQueue
 		node = traceQueue2.front();
 		traceQueue2.pop();
 		total++;
-		if ((count + total / 2) % percentFive == 0)
-		{
-			std::cout << "Progress:" << (count + total / 2) / percentFive * 5 << "%\r";
-		}
+		progress.Poll(count + total / 2);
 
 		bInPQ = false;
-		for (i = 0; i < 8; i++)
+		for (i = 0; i < NB::Count; i++)
 		{
-			iRow = Get_rowTo(i, node.row);
-			iCol = Get_colTo(i, node.col);
+			iRow = Get_rowTo<NB>(i, node.row);
+			iCol = Get_colTo<NB>(i, node.col);
 			if (flag2.IsProcessedDirect(iRow, iCol)) continue;
 
 			if (flag.IsProcessedDirect(iRow, iCol)) {
@@ -134,7 +136,8 @@ void ProcessTraceQue(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& traceQueue
 	count = count0 + total - nPSC;
 }
 // ݵأͨݵDEM
-void ProcessPit(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& depressionQue, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& count, int percentFive)
+template <class NB>
+void ProcessPit(CDEM& dem, Flag& flag, Flag& flag2, NodeQueue& depressionQue, NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress)
 {
 	int iRow, iCol, i;
 	float iSpill;
@@ -147,14 +150,11 @@ void ProcessPit(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& depressionQue,
 		node = depressionQue.front();
 		depressionQue.pop();
 		count++;
-		if (count % percentFive == 0)
-		{
-			std::cout << "Progress:" << count / percentFive * 5 << "%\r";
-		}
-		for (i = 0; i < 8; i++)
+		progress.Poll(count);
+		for (i = 0; i < NB::Count; i++)
 		{
-			iRow = Get_rowTo(i, node.row);
-			iCol = Get_colTo(i, node.col);
+			iRow = Get_rowTo<NB>(i, node.row);
+			iCol = Get_colTo<NB>(i, node.col);
 
 			if (flag.IsProcessedDirect(iRow, iCol)) continue;
 			iSpill = dem.asFloat(iRow, iCol);
@@ -180,13 +180,59 @@ void ProcessPit(CDEM& dem, Flag& flag, Flag& flag2, queue<Node>& depressionQue,
 	}
 }
 
-void FillDEM_Zhou_TwoPass(const char* inputFile, const char* outputFilledPath)
+//handles the unprocessed neighbours of a cell taken from the PQ; interior cells skip the bounds checks
+template <class NB, bool Interior>
+static void ProcessNeighbours(CDEM& dem, Flag& flag, Flag& flag2, NodeQueue& depressionQue, NodeQueue& traceQueue, NodeQueue& traceQueue2, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress, int row, int col, float spill)
 {
-	queue<Node> traceQueue;//׷ٶ
-	queue<Node> depressionQue;//ݵصб
+	int iRow, iCol;
+	float iSpill;
+	Node tmpNode;
+	for (int i = 0; i < NB::Count; i++)
+	{
+
+		iRow = Get_rowTo<NB>(i, row);
+		iCol = Get_colTo<NB>(i, col);
+
+		if (flag.IsProcessedAt<Interior>(iRow, iCol)) continue;
+
+		iSpill = dem.asFloat(iRow, iCol);
+		if (iSpill <= spill)
+		{
+			//depression cell
+			dem.Set_Value(iRow, iCol, spill);
+			flag.SetFlags(iRow, iCol, flag2);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = spill;
+			depressionQue.push(tmpNode);
+			ProcessPit<NB>(dem, flag, flag2, depressionQue, traceQueue, priorityQueue, count, progress);
+		}
+		else
+		{
+			//slope cell
+			flag.SetFlags(iRow, iCol, flag2);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = iSpill;
+			traceQueue.push(tmpNode);
+		}
+		ProcessTraceQue<NB>(dem, flag, flag2, traceQueue, traceQueue2, priorityQueue, count, progress);
+	}
+}
+
+template <class NB>
+static void FillDEM_Zhou_TwoPass_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	PhaseSpan run("FillDEM_Zhou_TwoPass");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	NodeQueue& traceQueue = workspace->traceQueue;//׷ٶ
+	NodeQueue& depressionQue = workspace->depressionQue;//ݵصб
 
 	//
-	CDEM dem;
+	CDEM& dem = workspace->dem;
 	double geoTransformArgs[6];
 	std::cout << "Reading tiff files..." << endl;
 	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
@@ -197,87 +243,60 @@ void FillDEM_Zhou_TwoPass(const char* inputFile, const char* outputFilledPath)
 
 	std::cout << "Finish reading data" << endl;
 
-	time_t timeStart, timeEnd;
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
 
-	timeStart = time(NULL);
+	PhaseSpan fillSpan("fill");
 	std::cout << "Using the two-pass implementation of the proposed variant to fill DEM" << endl;
 
 
-	Flag flag;
-	if (!flag.Init(width, height)) {
-		printf("Out of memory!\n");
-		return;
-	}
-
-	Flag flag2;
-	if (!flag2.Init(width, height)) {
+	if (!workspace->Prepare(width, height, 2)) {
 		printf("Failed to allocate memory!\n");
 		return;
 	}
+	Flag& flag = workspace->flag;
+	Flag& flag2 = workspace->flag2;
 
-	PriorityQueue priorityQueue;
-	int percentFive;
-	int count = 0, potentialSpillCount = 0;
-	int iRow, iCol, row, col;
-	float iSpill, spill;
+	PriorityQueue& priorityQueue = workspace->priorityQueue;
+	long long count = 0, potentialSpillCount = 0;
+	int row, col;
+	float spill;
 
-	InitPriorityQue(dem, flag, flag2, traceQueue, priorityQueue, percentFive);
+	InitPriorityQue<NB>(dem, flag, flag2, traceQueue, priorityQueue, *progress);
 	while (!priorityQueue.empty())
 	{
 		Node tmpNode = priorityQueue.top();
 		priorityQueue.pop();
 		count++;
-		if (count % percentFive == 0)
-		{
-			std::cout << "Progress:" << count / percentFive * 5 << "%\r";
-		}
+		if (!progress->Poll(count)) break;
 		row = tmpNode.row;
 		col = tmpNode.col;
 		spill = tmpNode.spill;
-		for (int i = 0; i < 8; i++)
-		{
-
-			iRow = Get_rowTo(i, row);
-			iCol = Get_colTo(i, col);
-
-			if (flag.IsProcessed(iRow, iCol)) continue;
-
-			iSpill = dem.asFloat(iRow, iCol);
-			if (iSpill <= spill)
-			{
-				//depression cell
-				dem.Set_Value(iRow, iCol, spill);
-				flag.SetFlags(iRow, iCol, flag2);
-				tmpNode.row = iRow;
-				tmpNode.col = iCol;
-				tmpNode.spill = spill;
-				depressionQue.push(tmpNode);
-				ProcessPit(dem, flag, flag2, depressionQue, traceQueue, priorityQueue, count, percentFive);
-			}
-			else
-			{
-				//slope cell
-				flag.SetFlags(iRow, iCol, flag2);
-				tmpNode.row = iRow;
-				tmpNode.col = iCol;
-				tmpNode.spill = iSpill;
-				traceQueue.push(tmpNode);
-			}
-			ProcessTraceQue(dem, flag, flag2, traceQueue, priorityQueue, count, percentFive);
-		}
+		if (IsInterior(row, col, width, height)) ProcessNeighbours<NB, true>(dem, flag, flag2, depressionQue, traceQueue, workspace->traceQueue2, priorityQueue, count, *progress, row, col, spill);
+		else ProcessNeighbours<NB, false>(dem, flag, flag2, depressionQue, traceQueue, workspace->traceQueue2, priorityQueue, count, *progress, row, col, spill);
 	}
-	timeEnd = time(NULL);
-	double consumeTime = difftime(timeEnd, timeStart);
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		return;
+	}
+	double consumeTime = fillSpan.End();
 	std::cout << "Time used:" << consumeTime << " seconds" << endl;
 
 	//ͳ
 	double min, max, mean, stdDev;
 	calculateStatistics(dem, &min, &max, &mean, &stdDev);
 
-	CreateGeoTIFF(outputFilledPath, dem.Get_NY(), dem.Get_NX(),
-		(void*)dem.getDEMdata(), GDALDataType::GDT_Float32, geoTransformArgs,
+	workspace->WriteOutput(outputFilledPath, geoTransformArgs,
 		&min, &max, &mean, &stdDev, -9999);
 	return;
 }
+
+void FillDEM_Zhou_TwoPass(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		FillDEM_Zhou_TwoPass_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	else
+		FillDEM_Zhou_TwoPass_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
@@ -6,6 +6,9 @@
 #include "dem.h" // DEMصͷļ  
 #include "Node.h" // ڵͷļ  
 #include "utils.h" // ߺͷļ  
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
 #include <time.h> // ʱ䴦ͷļ  
 #include <list> // ˫⣨Ȼδδֱʹã  
 #include <stack> // ջ⣨Ȼδδֱʹã  
@@ -13,18 +16,16 @@
 
 using namespace std; // ʹñ׼ռ  
 
-// Node  
-typedef std::vector<Node> NodeVector;
-// ȼУʹNodeΪԪأNodeVectorΪײNode::GreaterΪȽϺ  
-typedef std::priority_queue<Node, NodeVector, Node::Greater> PriorityQueue;
 
 // ʼȼУ߽絥Ԫ  
-void InitPriorityQue_onepass(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& percentFive)
+template <class NB>
+long long InitPriorityQue_onepass(CDEM& dem, Flag& flag, NodeQueue& traceQueue, PriorityQueue& priorityQueue, ProgressSink& progress)
 {
+    PhaseSpan span("border seeding");
     // ȡDEMĿȺ͸߶  
     int width = dem.Get_NX();
     int height = dem.Get_NY();
-    int validElementsCount = 0; // ЧԪؼ  
+    long long validElementsCount = 0; // ЧԪؼ  
     Node tmpNode; // ʱڵ  
     int iRow, iCol; // ѭʾк  
     // DEMÿԪ  
@@ -33,17 +34,17 @@ void InitPriorityQue_onepass(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Pri
         for (int col = 0; col < width; col++)
         {
             // ǰԪNoData  
-            if (!dem.is_NoData(row, col))
+            if (dem.is_Valid(row, col))
             {
                 validElementsCount++; // ЧԪؼһ  
                 // ǰԪ8ھ  
-                for (int i = 0; i < 8; i++)
+                for (int i = 0; i < NB::Count; i++)
                 {
                     // ھӵк  
-                    iRow = Get_rowTo(i, row);
-                    iCol = Get_colTo(i, col);
+                    iRow = Get_rowTo<NB>(i, row);
+                    iCol = Get_colTo<NB>(i, col);
                     // ھӲڻNoData  
-                    if (!dem.is_InGrid(iRow, iCol) || dem.is_NoData(iRow, iCol))
+                    if (!dem.is_Valid(iRow, iCol))
                     {
                         // ǰԪȼ  
                         tmpNode.col = col;
@@ -66,11 +67,61 @@ void InitPriorityQue_onepass(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Pri
     }
 
     // ÿ5%ȵԪ  
-    percentFive = validElementsCount / 20;
+    progress.SetTotal(validElementsCount);
+    return validElementsCount;
 }
 
 // ׷ٶеĽڵ  
-void ProcessTraceQue_onepass(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& count, int percentFive)
+template <class NB>
+class OnePassTraceKernel : public TraceKernel
+{
+public:
+    CDEM& dem;
+    Flag& flag;
+    OnePassTraceKernel(CDEM& dem, Flag& flag) : dem(dem), flag(flag) {}
+    //one step of ProcessTraceQue_onepass with atomic flags
+    virtual void Expand(const Node& node, TraceWorker& worker)
+    {
+        bool bInPQ = false;
+        Node N;
+        for (int i = 0; i < NB::Count; i++)
+        {
+            int iRow = Get_rowTo<NB>(i, node.row);
+            int iCol = Get_colTo<NB>(i, node.col);
+            if (flag.IsProcessedAtomic(iRow, iCol)) continue;
+            float iSpill = dem.asFloat(iRow, iCol);
+            if (iSpill <= node.spill) {
+                if (!bInPQ) {
+                    bool isBoundary = true;
+                    for (int j = 0; j < NB::Count; j++)
+                    {
+                        int jRow = Get_rowTo<NB>(j, iRow);
+                        int jCol = Get_colTo<NB>(j, iCol);
+                        if (flag.IsProcessedAtomic(jRow, jCol) && dem.asFloat(jRow, jCol) < iSpill)
+                        {
+                            isBoundary = false;
+                            break;
+                        }
+                    }
+                    if (isBoundary) {
+                        worker.Spill(node);
+                        bInPQ = true;
+                    }
+                }
+                continue;
+            }
+            //another worker may have claimed N in the meantime
+            if (!flag.ClaimFlag(iRow, iCol)) continue;
+            N.col = iCol;
+            N.row = iRow;
+            N.spill = iSpill;
+            worker.Push(N);
+        }
+    }
+};
+
+template <class NB>
+void ProcessTraceQue_onepass(CDEM& dem, Flag& flag, NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress, TracePool& tracePool)
 {
 
     // Ҫ߼Ǳ׷ٶУÿڵھӣ׷ٶкȼ
@@ -79,24 +130,31 @@ void ProcessTraceQue_onepass(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Pri
     Node N, node, headNode;
     int width = dem.Get_NX();
     int height = dem.Get_NY();
-    int total = 0, nPSC = 0;
+    long long total = 0, nPSC = 0;
     bool bInPQ = false;
     bool isBoundary;
     int j, jRow, jCol;
     while (!traceQueue.empty())
     {
+        if (traceQueue.size() >= tracePool.GetMinFront() && tracePool.Usable(dem, flag))
+        {
+            //a large front: trace the rest of it on all workers
+            OnePassTraceKernel<NB> kernel(dem, flag);
+            total += tracePool.Run(kernel, traceQueue, progress, count + total);
+            const vector<Node>& spillCells = tracePool.GetSpillCells();
+            for (size_t k = 0; k < spillCells.size(); k++) priorityQueue.push(spillCells[k]);
+            nPSC += spillCells.size();
+            break;
+        }
         node = traceQueue.front();
         traceQueue.pop();
         total++;
-        if ((count + total) % percentFive == 0)
-        {
-            std::cout << "Progress:" << (count + total) / percentFive * 5 << "%\r";
-        }
+        progress.Poll(count + total);
         bInPQ = false;
-        for (i = 0; i < 8; i++)
+        for (i = 0; i < NB::Count; i++)
         {
-            iRow = Get_rowTo(i, node.row);
-            iCol = Get_colTo(i, node.col);
+            iRow = Get_rowTo<NB>(i, node.row);
+            iCol = Get_colTo<NB>(i, node.col);
             if (flag.IsProcessedDirect(iRow, iCol)) continue;
 
             iSpill = dem.asFloat(iRow, iCol);
@@ -105,10 +163,10 @@ void ProcessTraceQue_onepass(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Pri
                 if (!bInPQ) {
                     //decide  whether (iRow, iCol) is a true border cell
                     isBoundary = true;
-                    for (j = 0; j < 8; j++)
+                    for (j = 0; j < NB::Count; j++)
                     {
-                        jRow = Get_rowTo(j, iRow);
-                        jCol = Get_colTo(j, iCol);
+                        jRow = Get_rowTo<NB>(j, iRow);
+                        jCol = Get_colTo<NB>(j, iCol);
                         if (flag.IsProcessedDirect(jRow, jCol) && dem.asFloat(jRow, jCol) < iSpill)
                         {
                             isBoundary = false;
@@ -136,7 +194,8 @@ void ProcessTraceQue_onepass(CDEM& dem, Flag& flag, queue<Node>& traceQueue, Pri
 }
 
 // ݵصԪ  
-void ProcessPit_onepass(CDEM& dem, Flag& flag, queue<Node>& depressionQue, queue<Node>& traceQueue, PriorityQueue& priorityQueue, int& count, int percentFive)
+template <class NB>
+void ProcessPit_onepass(CDEM& dem, Flag& flag, NodeQueue& depressionQue, NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress)
 {
 
     // Ҫ߼ǱݵضУÿݵصԪھӣݵضк׷ٶ  
@@ -151,14 +210,11 @@ void ProcessPit_onepass(CDEM& dem, Flag& flag, queue<Node>& depressionQue, queue
         node = depressionQue.front();
         depressionQue.pop();
         count++;
-        if (count % percentFive == 0)
+        progress.Poll(count);
+        for (i = 0; i < NB::Count; i++)
         {
-            std::cout << "Progress:" << count / percentFive * 5 << "%\r";
-        }
-        for (i = 0; i < 8; i++)
-        {
-            iRow = Get_rowTo(i, node.row);
-            iCol = Get_colTo(i, node.col);
+            iRow = Get_rowTo<NB>(i, node.row);
+            iCol = Get_colTo<NB>(i, node.col);
 
             if (flag.IsProcessedDirect(iRow, iCol)) continue;
             iSpill = dem.asFloat(iRow, iCol);
@@ -183,21 +239,66 @@ void ProcessPit_onepass(CDEM& dem, Flag& flag, queue<Node>& depressionQue, queue
     }
 }
 
+//handles the unprocessed neighbours of a cell taken from the PQ; interior cells skip the bounds checks
+template <class NB, bool Interior>
+static void ProcessNeighbours_onepass(CDEM& dem, Flag& flag, NodeQueue& depressionQue, NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress, TracePool& tracePool, int row, int col, float spill)
+{
+    int iRow, iCol;
+    float iSpill;
+    Node tmpNode;
+    for (int i = 0; i < NB::Count; i++)
+    {
+
+        iRow = Get_rowTo<NB>(i, row);
+        iCol = Get_colTo<NB>(i, col);
+
+        if (flag.IsProcessedAt<Interior>(iRow, iCol)) continue;
+        iSpill = dem.asFloat(iRow, iCol);
+        if (iSpill <= spill)
+        {
+            //depression cell
+            dem.Set_Value(iRow, iCol, spill);
+            flag.SetFlag(iRow, iCol);
+            tmpNode.row = iRow;
+            tmpNode.col = iCol;
+            tmpNode.spill = spill;
+            depressionQue.push(tmpNode);
+            ProcessPit_onepass<NB>(dem, flag, depressionQue, traceQueue, priorityQueue, count, progress);
+        }
+        else
+        {
+            //slope cell
+            flag.SetFlag(iRow, iCol);
+            tmpNode.row = iRow;
+            tmpNode.col = iCol;
+            tmpNode.spill = iSpill;
+            traceQueue.push(tmpNode);
+        }
+        ProcessTraceQue_onepass<NB>(dem, flag, traceQueue, priorityQueue, count, progress, tracePool);
+    }
+}
+
 // ʹZhouһ㷨DEM  
-void FillDEM_Zhou_OnePass(const char* inputFile, const char* outputFilledPath)
+template <class NB>
+static void FillDEM_Zhou_OnePass_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
 {
+    PhaseSpan run("FillDEM_Zhou_OnePass");
+    ProgressSink consoleProgress;
+    if (progress == NULL) progress = &consoleProgress;
+    FillWorkspace localWorkspace;
+    if (workspace == NULL) workspace = &localWorkspace;
     // ׷ٶкݵض  
-    queue<Node> traceQueue;
-    queue<Node> depressionQue;
+    NodeQueue& traceQueue = workspace->traceQueue;
+    NodeQueue& depressionQue = workspace->depressionQue;
 
     // ȡDEM  
-    CDEM dem;
+    CDEM& dem = workspace->dem;
     double geoTransformArgs[6]; // 任  
     
 
     cout << "Reading tiff files..." << endl;
     //readTIFFڶȡGeoTIFFļļ·͡DEMú͵任
-    if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs))
+    if (!workspace->ReadInput(inputFile, geoTransformArgs))
     {
         printf("Error occurred while reading GeoTIFF file!\n");
         return;
@@ -206,90 +307,83 @@ void FillDEM_Zhou_OnePass(const char* inputFile, const char* outputFilledPath)
     cout << "Finish reading data" << endl;
     
     // ¼ʼʱ  
-    time_t timeStart, timeEnd;
     int width = dem.Get_NX();
     int height = dem.Get_NY();
      
     cout << "DEM size: " << width << " x " << height << endl;
 
-    timeStart = time(NULL);
+    PhaseSpan fillSpan("fill");
     cout << "Using the one-pass implementation of the proposed variant to fill DEM" << endl;
 
     // ʼ  
-    Flag flag;
-    if (!flag.Init(width, height)) {
+    if (!workspace->Prepare(width, height)) {
         printf("Failed to allocate memory!\n");
         return;
     }
+    Flag& flag = workspace->flag;
+    Checkpointer& checkpoint = workspace->checkpoint;
 
     // ȼ  
-    PriorityQueue priorityQueue;
-    int percentFive; // ÿ5%ȵԪ  
-    int count = 0, potentialSpillCount = 0; //  
-    int iRow, iCol, row, col;
-    float iSpill, spill;
+    PriorityQueue& priorityQueue = workspace->priorityQueue;
+    long long count = 0, potentialSpillCount = 0; //  
+    int row, col;
+    float spill;
 
     // ʼȼ  
-    InitPriorityQue_onepass(dem, flag, traceQueue, priorityQueue, percentFive);
+    long long validElementsCount = 0;
+    if (checkpoint.Resuming())
+    {
+        workspace->RestoreCheckpoint(count, validElementsCount);
+        progress->SetTotal(validElementsCount);
+    }
+    else validElementsCount = InitPriorityQue_onepass<NB>(dem, flag, traceQueue, priorityQueue, *progress);
+    checkpoint.Start("zhou-onepass", NB::Count, geoTransformArgs, validElementsCount, count);
     // ȼеĽڵ  
     while (!priorityQueue.empty())
     {
-        Node tmpNode = priorityQueue.top();
-        priorityQueue.pop();
+        //the depression and trace queues are empty here
+        if (checkpoint.Due(count)) workspace->SaveCheckpoint(count);
         count++;
         // Ϣ  
-        if (count % percentFive == 0)
-        {
-            cout << "Progress:" << count / percentFive * 5 << "%\r";
-        }
+        if (!progress->Poll(count)) break;
+        Node tmpNode = priorityQueue.top();
+        priorityQueue.pop();
 
         // Ҫ߼ǱǰڵھӣݵضС׷ٶкȼ  
         row = tmpNode.row;
         col = tmpNode.col;
         spill = tmpNode.spill;
 
-        for (int i = 0; i < 8; i++)
-        {
-
-            iRow = Get_rowTo(i, row);
-            iCol = Get_colTo(i, col);
-
-            if (flag.IsProcessed(iRow, iCol)) continue;
-            iSpill = dem.asFloat(iRow, iCol);
-            if (iSpill <= spill)
-            {
-                //depression cell
-                dem.Set_Value(iRow, iCol, spill);
-                flag.SetFlag(iRow, iCol);
-                tmpNode.row = iRow;
-                tmpNode.col = iCol;
-                tmpNode.spill = spill;
-                depressionQue.push(tmpNode);
-                ProcessPit_onepass(dem, flag, depressionQue, traceQueue, priorityQueue, count, percentFive);
-            }
-            else
-            {
-                //slope cell
-                flag.SetFlag(iRow, iCol);
-                tmpNode.row = iRow;
-                tmpNode.col = iCol;
-                tmpNode.spill = iSpill;
-                traceQueue.push(tmpNode);
-            }
-            ProcessTraceQue_onepass(dem, flag, traceQueue, priorityQueue, count, percentFive);
-        }
+        if (IsInterior(row, col, width, height)) ProcessNeighbours_onepass<NB, true>(dem, flag, depressionQue, traceQueue, priorityQueue, count, *progress, workspace->tracePool, row, col, spill);
+        else ProcessNeighbours_onepass<NB, false>(dem, flag, depressionQue, traceQueue, priorityQueue, count, *progress, workspace->tracePool, row, col, spill);
     }
     // ¼ʱ  
-    timeEnd = time(NULL);
-    double consumeTime = difftime(timeEnd, timeStart);
+    progress->Finish(count);
+    if (progress->Stopped())
+    {
+        cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+        //the cell of the last count was not taken yet
+        if (checkpoint.Enabled() && workspace->SaveCheckpoint(count - 1, true))
+            cout << "Checkpoint written to " << checkpoint.GetPath() << endl;
+        return;
+    }
+    checkpoint.Finish(true);
+    double consumeTime = fillSpan.End();
     cout << "Time used:" << consumeTime << " seconds" << endl;
 
     // ͳļ  
     double min, max, mean, stdDev;
     calculateStatistics(dem, &min, &max, &mean, &stdDev);
-    CreateGeoTIFF(outputFilledPath, dem.Get_NY(), dem.Get_NX(),
-        (void*)dem.getDEMdata(), GDALDataType::GDT_Float32, geoTransformArgs,
+    workspace->WriteOutput(outputFilledPath, geoTransformArgs,
         &min, &max, &mean, &stdDev, -9999);
 
     return;
-}
\ No newline at end of file
+}
+
+void FillDEM_Zhou_OnePass(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+    if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+        FillDEM_Zhou_OnePass_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+    else
+        FillDEM_Zhou_OnePass_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
@@ -0,0 +1,161 @@
+#include "FillDepth.h"
+#include "dem.h"
+#include "utils.h"
+#include "LargeAlloc.h"
+#include "PhaseTrace.h"
+#include <string.h>
+#include <vector>
+
+FillDepth::FillDepth()
+{
+	format = FILL_DEPTH_NONE;
+	step = 0.01f;
+	width = 0;
+	height = 0;
+	data = NULL;
+	bytes = 0;
+	changed = 0;
+	changeBits = NULL;
+	changeBytes = 0;
+	trackChanges = false;
+}
+
+FillDepth::~FillDepth()
+{
+	Free();
+}
+
+void FillDepth::SetFormat(FillDepthFormat format, float step)
+{
+	if (format != this->format) Free();
+	this->format = format;
+	this->step = step > 0 ? step : 0.01f;
+}
+
+size_t FillDepth::Bytes(FillDepthFormat format, size_t cells)
+{
+	switch (format)
+	{
+	case FILL_DEPTH_FLOAT: return cells * sizeof(float);
+	case FILL_DEPTH_UINT8: return cells;
+	case FILL_DEPTH_UINT16: return cells * sizeof(unsigned short);
+	case FILL_DEPTH_MASK: return (cells + 7) / 8;
+	default: return 0;
+	}
+}
+
+bool FillDepth::Init(int width, int height)
+{
+	size_t length = Bytes(format, (size_t)width * height);
+	if (data != NULL && bytes == length)
+	{
+		memset(data, 0, length);
+	}
+	else
+	{
+		Free();
+		if (length > 0)
+		{
+			data = AllocLarge(length, true);
+			if (data == NULL) return false;
+			bytes = length;
+		}
+	}
+	//the mask format is a change mask already
+	size_t maskLength = trackChanges && format != FILL_DEPTH_MASK ? Bytes(FILL_DEPTH_MASK, (size_t)width * height) : 0;
+	if (changeBits != NULL && changeBytes == maskLength)
+	{
+		memset(changeBits, 0, maskLength);
+	}
+	else
+	{
+		FreeLarge(changeBits);
+		changeBits = NULL;
+		changeBytes = 0;
+		if (maskLength > 0)
+		{
+			changeBits = (unsigned char*)AllocLarge(maskLength, true);
+			if (changeBits == NULL) return false;
+			changeBytes = maskLength;
+		}
+	}
+	this->width = width;
+	this->height = height;
+	changed = 0;
+	return true;
+}
+
+void FillDepth::Free()
+{
+	FreeLarge(data);
+	data = NULL;
+	bytes = 0;
+	FreeLarge(changeBits);
+	changeBits = NULL;
+	changeBytes = 0;
+}
+
+//one strip of the output raster in the GDAL type of the format
+template <class T>
+static void ConvertRows(const T* depth, const CDEM& dem, int firstRow, int rowCount, int width, T noData, T* strip)
+{
+	for (int r = 0; r < rowCount; r++)
+	{
+		const T* line = depth + (size_t)(firstRow + r) * width;
+		T* out = strip + (size_t)r * width;
+		for (int col = 0; col < width; col++)
+		{
+			out[col] = dem.is_Valid(firstRow + r, col) ? line[col] : noData;
+		}
+	}
+}
+
+bool FillDepth::Write(const char* path, const CDEM& dem, double* geoTransformArray6Eles) const
+{
+	if (format == FILL_DEPTH_NONE || data == NULL) return false;
+	PhaseSpan span("write depth");
+	GDALDataType type = format == FILL_DEPTH_FLOAT ? GDT_Float32 : format == FILL_DEPTH_UINT16 ? GDT_UInt16 : GDT_Byte;
+	double noData = format == FILL_DEPTH_FLOAT ? NO_DATA_VALUE : format == FILL_DEPTH_UINT16 ? 65535 : 255;
+	GDALDataset* poDataset = CreateGeoTIFFDataset(path, height, width, type, geoTransformArray6Eles, noData);
+	if (poDataset == NULL) return false;
+	GDALRasterBand* poBand = poDataset->GetRasterBand(1);
+
+	int cellBytes = GDALGetDataTypeSize(type) / 8;
+	int stripRows = std::max(1, (1 << 20) / std::max(width, 1));
+	std::vector<unsigned char> strip((size_t)stripRows * width * cellBytes);
+	CPLErr err = CE_None;
+	for (int row = 0; row < height && err == CE_None; row += stripRows)
+	{
+		int rowCount = std::min(stripRows, height - row);
+		PhaseSpan stripSpan("strip");
+		switch (format)
+		{
+		case FILL_DEPTH_FLOAT:
+			ConvertRows((const float*)data, dem, row, rowCount, width, (float)NO_DATA_VALUE, (float*)&strip[0]);
+			break;
+		case FILL_DEPTH_UINT8:
+			ConvertRows((const unsigned char*)data, dem, row, rowCount, width, (unsigned char)255, &strip[0]);
+			break;
+		case FILL_DEPTH_UINT16:
+			ConvertRows((const unsigned short*)data, dem, row, rowCount, width, (unsigned short)65535, (unsigned short*)&strip[0]);
+			break;
+		default:
+		{
+			const unsigned char* bits = (const unsigned char*)data;
+			for (int r = 0; r < rowCount; r++)
+			{
+				size_t index = (size_t)(row + r) * width;
+				unsigned char* out = &strip[(size_t)r * width];
+				for (int col = 0; col < width; col++, index++)
+				{
+					out[col] = !dem.is_Valid(row + r, col) ? 255 : (bits[index >> 3] >> (index & 7)) & 1;
+				}
+			}
+			break;
+		}
+		}
+		err = poBand->RasterIO(GF_Write, 0, row, width, rowCount, (void*)&strip[0], width, rowCount, type, 0, 0);
+	}
+	GDALClose((GDALDatasetH)poDataset);
+	return err == CE_None;
+}
@@ -0,0 +1,118 @@
+#ifndef FILL_DEPTH_HEAD_H
+#define FILL_DEPTH_HEAD_H
+
+#include <stddef.h>
+#include <math.h>
+#include <algorithm>
+
+class CDEM;
+
+enum FillDepthFormat
+{
+	FILL_DEPTH_NONE = 0,
+	//float32 depth in DEM units
+	FILL_DEPTH_FLOAT,
+	//depth in steps of GetStep(), saturating at 254 / 65534; raises only
+	FILL_DEPTH_UINT8,
+	FILL_DEPTH_UINT16,
+	//one bit per cell, set for every changed cell; written as 0 / 1 bytes
+	FILL_DEPTH_MASK
+};
+
+/*
+*	Fill depth (filled - original elevation) recorded while the engines fill.
+*	CDEM::Set_Value calls Record whenever it changes a cell, so the depth needs
+*	neither a copy of the input DEM nor a pass to subtract it. Breaching
+*	lowers cells: the float depth goes negative there and the mask is set,
+*	while the quantized formats keep only the raises. Cells are kept
+*	row-major whatever the DEM layout or storage. Depths of repeated raises of
+*	one cell add up; the quantized formats round each raise, which is exact
+*	for the engines here since they raise a cell at most once. A quantized
+*	depth is at least 1 for any raised cell, so 0 always means "not filled".
+*/
+class FillDepth
+{
+private:
+	FillDepthFormat format;
+	float step;
+	int width, height;
+	void* data;
+	size_t bytes;
+	long long changed;
+	//one bit per changed cell, kept next to a depth format that cannot
+	//tell every change (see TrackChanges)
+	unsigned char* changeBits;
+	size_t changeBytes;
+	bool trackChanges;
+
+	static size_t Bytes(FillDepthFormat format, size_t cells);
+	template <class T>
+	void Quantize(size_t index, float depth, T max)
+	{
+		T* cells = (T*)data;
+		double units = std::max(1.0, floor(depth / step + 0.5));
+		cells[index] = (T)std::min((double)max, cells[index] + units);
+	}
+public:
+	FillDepth();
+	~FillDepth();
+	//step is the depth of one unit of the quantized formats
+	void SetFormat(FillDepthFormat format, float step = 0.01f);
+	FillDepthFormat GetFormat() const { return format; }
+	//also keep a bit per changed cell from the next Init on, so IsChanged
+	//sees cuts and cancelling changes whatever the format; the in-place
+	//update needs it
+	void TrackChanges(bool track) { trackChanges = track; }
+	float GetStep() const { return step; }
+	//zeroes the depth of a width x height DEM; the storage is reused if it
+	//already has the right size
+	bool Init(int width, int height);
+	void Free();
+	//(row, col) was changed from 'from' to 'to'
+	inline void Record(int row, int col, float from, float to)
+	{
+		size_t index = (size_t)row * width + col;
+		float depth = to - from;
+		changed++;
+		if (changeBits != NULL) changeBits[index >> 3] |= (unsigned char)(1 << (index & 7));
+		switch (format)
+		{
+		case FILL_DEPTH_FLOAT:
+			((float*)data)[index] += depth;
+			break;
+		case FILL_DEPTH_UINT8:
+			if (depth > 0) Quantize<unsigned char>(index, depth, 254);
+			break;
+		case FILL_DEPTH_UINT16:
+			if (depth > 0) Quantize<unsigned short>(index, depth, 65534);
+			break;
+		case FILL_DEPTH_MASK:
+			((unsigned char*)data)[index >> 3] |= (unsigned char)(1 << (index & 7));
+			break;
+		default:
+			break;
+		}
+	}
+	//true if (row, col) was changed since Init; without TrackChanges the
+	//quantized formats see raises only and the float format net changes
+	bool IsChanged(int row, int col) const
+	{
+		size_t index = (size_t)row * width + col;
+		if (changeBits != NULL) return (changeBits[index >> 3] >> (index & 7)) & 1;
+		switch (format)
+		{
+		case FILL_DEPTH_FLOAT: return ((const float*)data)[index] != 0;
+		case FILL_DEPTH_UINT8: return ((const unsigned char*)data)[index] != 0;
+		case FILL_DEPTH_UINT16: return ((const unsigned short*)data)[index] != 0;
+		case FILL_DEPTH_MASK: return (((const unsigned char*)data)[index >> 3] >> (index & 7)) & 1;
+		default: return false;
+		}
+	}
+	//number of Record calls since Init
+	long long GetChangedCells() const { return changed; }
+	//writes the depth as a GeoTIFF, strip by strip; NoData cells of dem get
+	//-9999 (float), 65535 (uint16) or 255 (uint8 and mask)
+	bool Write(const char* path, const CDEM& dem, double* geoTransformArray6Eles) const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
+#include <stdio.h>
+
+//size the flags for a width x height DEM and empty the queues; existing
+//storage is reused when it is already large enough
+bool FillWorkspace::Prepare(int width, int height, int flagCount)
+{
+	PhaseSpan span("prepare");
+#ifdef USE_EXTERNAL_PRIORITY_QUEUE
+	//the runs on disk cannot be copied without draining them
+	if (checkpoint.Enabled())
+	{
+		printf("Checkpoints need an in-memory priority queue, running without them\n");
+		checkpoint.SetPath(std::string());
+	}
+#endif
+	if (dem.GetStorage() == DEM_STORAGE_PAGED)
+	{
+		//out-of-core DEM: page the flags too, next to the DEM scratch file
+		std::string path = dem.GetScratchPath();
+		if (!flag.InitPaged(width, height, 0, path.empty() ? path : path + ".flag1")) return false;
+		if (flagCount > 1 && !flag2.InitPaged(width, height, 0, path.empty() ? path : path + ".flag2")) return false;
+	}
+	else
+	{
+		if (!flag.Init(width, height)) return false;
+		if (flagCount > 1 && !flag2.Init(width, height)) return false;
+	}
+
+	//the update needs the changed cells; one bit each is enough
+	if (depthForUpdate && outputFormat != OUTPUT_UPDATE)
+	{
+		depth.SetFormat(FILL_DEPTH_NONE);
+		depthForUpdate = false;
+	}
+	if (outputFormat == OUTPUT_UPDATE && depth.GetFormat() == FILL_DEPTH_NONE)
+	{
+		depth.SetFormat(FILL_DEPTH_MASK);
+		depthForUpdate = true;
+	}
+	//a quantized depth drops cuts, and a float one cells whose changes cancel
+	depth.TrackChanges(outputFormat == OUTPUT_UPDATE);
+	if (depth.GetFormat() != FILL_DEPTH_NONE)
+	{
+		if (!depth.Init(width, height)) return false;
+		dem.SetFillDepth(&depth);
+	}
+	else dem.SetFillDepth(NULL);
+
+	priorityQueue.clear();
+	depressionQue.clear();
+	traceQueue.clear();
+	traceQueue2.clear();
+	//the queues start around the size of the DEM border
+	size_t border = 2 * ((size_t)width + height);
+	depressionQue.reserve(border);
+	traceQueue.reserve(border);
+	return true;
+}
+
+bool FillWorkspace::StorageFailed() const
+{
+	BlockCache* blocks = dem.GetBlocks();
+	return (blocks != NULL && blocks->Failed()) ||
+		(flag.pager != NULL && flag.pager->Failed()) ||
+		(flag2.pager != NULL && flag2.pager->Failed());
+}
+
+bool FillWorkspace::WriteOutput(const char* path, double* geoTransformArray6Eles,
+	double* min, double* max, double* mean, double* stdDev, double nodatavalue)
+{
+	dem.SetFillDepth(NULL);
+#ifdef USE_EXTERNAL_PRIORITY_QUEUE
+	if (priorityQueue.Failed())
+	{
+		printf("The priority queue lost cells with a run it could not read back, no output written\n");
+		return false;
+	}
+#endif
+	if (StorageFailed())
+	{
+		printf("The block store lost pages of the fill, no output written\n");
+		return false;
+	}
+	bool ok;
+	if (outputFormat == OUTPUT_COG)
+		ok = CreateCOG(path, dem, geoTransformArray6Eles, min, max, mean, stdDev, nodatavalue, cog);
+	else if (outputFormat == OUTPUT_UPDATE)
+		ok = UpdateGeoTIFF(path, dem, depth, min, max, mean, stdDev, changeListPath.c_str(), &updateStats);
+	else
+		ok = CreateGeoTIFF(path, dem, geoTransformArray6Eles, min, max, mean, stdDev, nodatavalue);
+	//reading the DEM back for the output can fail as well
+	if (ok && StorageFailed())
+	{
+		printf("The block store failed while the output was written, %s is incomplete\n", path);
+		ok = false;
+	}
+	if (ok && depth.GetFormat() != FILL_DEPTH_NONE && !depthForUpdate && !depthPath.empty())
+	{
+		ok = depth.Write(depthPath.c_str(), dem, geoTransformArray6Eles);
+		if (ok) printf("Fill depth: %lld cells changed\n", depth.GetChangedCells());
+	}
+	return ok;
+}
+
+void FillWorkspace::Release()
+{
+	dem.SetFillDepth(NULL);
+	dem.freeMem();
+	depth.Free();
+	flag.Free();
+	flag2.Free();
+	priorityQueue = PriorityQueue();
+	depressionQue = NodeQueue();
+	traceQueue = NodeQueue();
+	traceQueue2 = NodeQueue();
+	delete engineState;
+	engineState = NULL;
+	checkpoint.Finish(false);
+	tracePool.Stop();
+}
+
+bool FillWorkspace::SaveCheckpoint(long long done, bool wait)
+{
+#ifdef USE_EXTERNAL_PRIORITY_QUEUE
+	//Prepare turned checkpoints off
+	(void)done;
+	(void)wait;
+	return false;
+#else
+	if (!checkpoint.Enabled()) return false;
+	if (wait) checkpoint.Wait();
+	//skip this one while the last snapshot is still being written
+	if (!checkpoint.Ready()) return false;
+	for (int q = 0; q < CHECKPOINT_QUEUES; q++) checkpoint.queues[q].clear();
+	priorityQueue.CopyTo(checkpoint.queues[CHECKPOINT_PRIORITY_QUEUE]);
+	depressionQue.CopyTo(checkpoint.queues[CHECKPOINT_DEPRESSION_QUEUE]);
+	traceQueue.CopyTo(checkpoint.queues[CHECKPOINT_TRACE_QUEUE]);
+	if (!checkpoint.Save(done, dem, flag)) return false;
+	return wait ? checkpoint.Wait() : true;
+#endif
+}
+
+bool FillWorkspace::ReadInput(const char* inputFile, double* geoTransformArray6Eles)
+{
+	if (checkpoint.Resuming()) return checkpoint.LoadDEM(dem, geoTransformArray6Eles);
+	return readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArray6Eles);
+}
+
+void FillWorkspace::RestoreCheckpoint(long long& done, long long& total)
+{
+	done = checkpoint.GetHeader().done;
+	total = checkpoint.GetHeader().total;
+	checkpoint.LoadFlags(flag);
+	for (size_t i = 0; i < checkpoint.queues[CHECKPOINT_PRIORITY_QUEUE].size(); i++)
+		priorityQueue.push(checkpoint.queues[CHECKPOINT_PRIORITY_QUEUE][i]);
+	for (size_t i = 0; i < checkpoint.queues[CHECKPOINT_DEPRESSION_QUEUE].size(); i++)
+		depressionQue.push(checkpoint.queues[CHECKPOINT_DEPRESSION_QUEUE][i]);
+	for (size_t i = 0; i < checkpoint.queues[CHECKPOINT_TRACE_QUEUE].size(); i++)
+		traceQueue.push(checkpoint.queues[CHECKPOINT_TRACE_QUEUE][i]);
+}
@@ -0,0 +1,223 @@
+#ifndef FILL_WORKSPACE_HEAD_H
+#define FILL_WORKSPACE_HEAD_H
+
+#include <queue>
+#include <vector>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "RadixHeap.h"
+#include "ExternalPriorityQueue.h"
+#include "LargeAlloc.h"
+#include "ParallelTrace.h"
+#include "CogWriter.h"
+#include "FillDepth.h"
+#include "InPlaceUpdate.h"
+#include "Checkpoint.h"
+
+typedef std::vector<Node> NodeVector;
+
+enum OutputFormat
+{
+	OUTPUT_GEOTIFF = 0,
+	//Cloud-Optimized GeoTIFF with overviews, see CogWriter.h
+	OUTPUT_COG,
+	//rewrite only the changed blocks of an existing GeoTIFF, see InPlaceUpdate.h;
+	//the engines' output path must name the input file (or a copy of it)
+	OUTPUT_UPDATE
+};
+
+//std::priority_queue that can be emptied without giving its storage back
+class StdPriorityQueue : public std::priority_queue<Node, NodeVector, Node::Greater>
+{
+public:
+	void clear()
+	{
+		c.clear();
+	}
+	//true if the next node is at spill, as RadixHeap::hasAt
+	bool hasAt(float spill) const
+	{
+		return !empty() && top().spill == spill;
+	}
+	//appends every node, in heap order, for a checkpoint
+	void CopyTo(NodeVector& nodes) const
+	{
+		nodes.insert(nodes.end(), c.begin(), c.end());
+	}
+};
+
+#if defined(USE_STD_PRIORITY_QUEUE)
+typedef StdPriorityQueue PriorityQueue;
+#elif defined(USE_EXTERNAL_PRIORITY_QUEUE)
+typedef ExternalPriorityQueue PriorityQueue;
+#else
+typedef RadixHeap PriorityQueue;
+#endif
+
+/*
+*	FIFO of Nodes on a power-of-two ring buffer. Replaces std::queue<Node>:
+*	the storage only grows (by doubling) and is kept by clear(), so a warm
+*	queue never allocates.
+*/
+class NodeQueue
+{
+private:
+	std::vector<Node, LargeAllocator<Node> > buffer;
+	size_t head;
+	size_t count;
+	size_t mask;
+
+	void Grow()
+	{
+		size_t capacity = buffer.size();
+		std::vector<Node, LargeAllocator<Node> > larger(capacity == 0 ? 1024 : capacity * 2);
+		for (size_t i = 0; i < count; i++)
+		{
+			larger[i] = buffer[(head + i) & mask];
+		}
+		buffer.swap(larger);
+		head = 0;
+		mask = buffer.size() - 1;
+	}
+public:
+	NodeQueue()
+	{
+		head = 0;
+		count = 0;
+		mask = 0;
+	}
+	void reserve(size_t capacity)
+	{
+		while (buffer.size() < capacity) Grow();
+	}
+	bool empty() const
+	{
+		return count == 0;
+	}
+	size_t size() const
+	{
+		return count;
+	}
+	void push(const Node& node)
+	{
+		if (count == buffer.size()) Grow();
+		buffer[(head + count) & mask] = node;
+		count++;
+	}
+	const Node& front() const
+	{
+		return buffer[head];
+	}
+	void pop()
+	{
+		head = (head + 1) & mask;
+		count--;
+	}
+	void clear()
+	{
+		head = 0;
+		count = 0;
+	}
+	//appends the nodes front first, for a checkpoint
+	void CopyTo(NodeVector& nodes) const
+	{
+		for (size_t i = 0; i < count; i++) nodes.push_back(buffer[(head + i) & mask]);
+	}
+};
+
+/*
+*	Buffers that only one engine uses. The engine derives its state from
+*	EngineState in its own .cpp file and fetches it with
+*	FillWorkspace::GetEngineState; the workspace keeps the state of the last
+*	engine that asked, so repeated fills by that engine reuse its buffers.
+*/
+class EngineState
+{
+public:
+	virtual ~EngineState() {}
+};
+
+/*
+*	Everything a fill allocates: the DEM buffer, the Flag bit arrays, the
+*	priority queue and the FIFO queues. Pass the same workspace to repeated
+*	fills of DEMs of the same size and no memory is allocated after the first.
+*/
+class FillWorkspace
+{
+public:
+	CDEM dem;
+	Flag flag;
+	Flag flag2;
+	PriorityQueue priorityQueue;
+	NodeQueue depressionQue;
+	NodeQueue traceQueue;
+	//the second pass of Zhou two-pass, Wei's potential spill cells
+	NodeQueue traceQueue2;
+	//workers for the slope traces of the Zhou and Wei variants
+	TracePool tracePool;
+	//neighbourhood of the fill, D8 by default
+	Connectivity connectivity;
+	//format of the filled DEM, a plain GeoTIFF by default
+	OutputFormat outputFormat;
+	CogOptions cog;
+	//fill depth recorded during the fill (see FillDepth.h) and written next
+	//to the output when depthPath is set; off by default
+	FillDepth depth;
+	std::string depthPath;
+	//OUTPUT_UPDATE: optional sparse change list, and the counts of the last update
+	std::string changeListPath;
+	UpdateStats updateStats;
+	//periodic snapshots of the fill for FillDEM_Resume, off unless a path is set
+	Checkpointer checkpoint;
+private:
+	//depth was switched to FILL_DEPTH_MASK only to find the changed blocks
+	bool depthForUpdate;
+	EngineState* engineState;
+	//true once the block store of the DEM or a flag pager lost a page
+	bool StorageFailed() const;
+public:
+	FillWorkspace()
+	{
+		connectivity = CONNECTIVITY_D8;
+		outputFormat = OUTPUT_GEOTIFF;
+		updateStats.blocks = 0;
+		updateStats.blocksWritten = 0;
+		updateStats.cellsChanged = 0;
+		depthForUpdate = false;
+		engineState = NULL;
+	}
+	~FillWorkspace()
+	{
+		delete engineState;
+	}
+	//the buffers of one engine, created on first use; replaces the state
+	//of another engine
+	template <class State>
+	State* GetEngineState()
+	{
+		State* state = dynamic_cast<State*>(engineState);
+		if (state == NULL)
+		{
+			delete engineState;
+			engineState = state = new State();
+		}
+		return state;
+	}
+	bool Prepare(int width, int height, int flagCount = 1);
+	//writes dem to path in outputFormat, and the fill depth to depthPath;
+	//false without writing if the fill lost cells to a failed scratch file
+	bool WriteOutput(const char* path, double* geoTransformArray6Eles,
+		double* min, double* max, double* mean, double* stdDev, double nodatavalue);
+	void Release();
+	//snapshot of the DEM, flag and queues after done cells; wait = true also
+	//waits for the last snapshot and for this one to be written
+	bool SaveCheckpoint(long long done, bool wait = false);
+	//readTIFF of inputFile, or on a resume the DEM of the snapshot
+	bool ReadInput(const char* inputFile, double* geoTransformArray6Eles);
+	//after Prepare on a resume: the flags and queues of the snapshot, and
+	//the engine's count and progress total when it was taken
+	void RestoreCheckpoint(long long& done, long long& total);
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "FloatCodec.h"
+#include <string.h>
+
+//first byte of a compressed block
+enum
+{
+	BLOCK_RAW = 0,
+	BLOCK_PACKED = 1
+};
+
+static const int HASH_BITS = 14;
+static const int MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+
+static inline unsigned int Read32(const unsigned char* p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned int Hash32(unsigned int v)
+{
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+//255-continued length, as in LZ4
+static inline unsigned char* WriteLength(unsigned char* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+static inline unsigned char* WriteSequence(unsigned char* op, const unsigned char* literals, size_t literalCount,
+	size_t offset, size_t matchLength)
+{
+	unsigned char* token = op++;
+	size_t matchCode = matchLength >= MIN_MATCH ? matchLength - MIN_MATCH : 0;
+	*token = (unsigned char)(((literalCount >= 15 ? 15 : literalCount) << 4) | (matchCode >= 15 ? 15 : matchCode));
+	if (literalCount >= 15) op = WriteLength(op, literalCount - 15);
+	memcpy(op, literals, literalCount);
+	op += literalCount;
+	if (matchLength >= MIN_MATCH)
+	{
+		*op++ = (unsigned char)(offset & 0xFF);
+		*op++ = (unsigned char)(offset >> 8);
+		if (matchCode >= 15) op = WriteLength(op, matchCode - 15);
+	}
+	return op;
+}
+
+//greedy LZ77 with a single-entry hash table; out must hold n + n / 255 + 16 bytes
+size_t FloatCodec::PackLZ(const unsigned char* in, size_t n, unsigned char* out)
+{
+	std::vector<unsigned int> table((size_t)1 << HASH_BITS, 0xFFFFFFFFu);
+	unsigned char* op = out;
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + MIN_MATCH <= n)
+	{
+		unsigned int v = Read32(in + i);
+		unsigned int h = Hash32(v);
+		size_t candidate = table[h];
+		table[h] = (unsigned int)i;
+		if (candidate == 0xFFFFFFFFu || i - candidate > MAX_OFFSET || Read32(in + candidate) != v)
+		{
+			i++;
+			continue;
+		}
+		size_t length = MIN_MATCH;
+		while (i + length < n && in[candidate + length] == in[i + length]) length++;
+		op = WriteSequence(op, in + anchor, i - anchor, i - candidate, length);
+		i += length;
+		anchor = i;
+	}
+	//the last sequence carries only literals
+	op = WriteSequence(op, in + anchor, n - anchor, 0, 0);
+	return op - out;
+}
+
+bool FloatCodec::UnpackLZ(const unsigned char* in, size_t size, unsigned char* out, size_t n)
+{
+	const unsigned char* ip = in;
+	const unsigned char* end = in + size;
+	size_t o = 0;
+	while (ip < end)
+	{
+		unsigned char token = *ip++;
+		size_t literalCount = token >> 4;
+		if (literalCount == 15)
+		{
+			unsigned char b;
+			do
+			{
+				if (ip >= end) return false;
+				b = *ip++;
+				literalCount += b;
+			} while (b == 255);
+		}
+		if ((size_t)(end - ip) < literalCount || n - o < literalCount) return false;
+		memcpy(out + o, ip, literalCount);
+		ip += literalCount;
+		o += literalCount;
+		if (ip >= end) break;
+
+		if (end - ip < 2) return false;
+		size_t offset = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		size_t matchLength = token & 15;
+		if (matchLength == 15)
+		{
+			unsigned char b;
+			do
+			{
+				if (ip >= end) return false;
+				b = *ip++;
+				matchLength += b;
+			} while (b == 255);
+		}
+		matchLength += MIN_MATCH;
+		if (offset == 0 || offset > o || n - o < matchLength) return false;
+		//byte by byte: the match may overlap its own output
+		const unsigned char* src = out + o - offset;
+		for (size_t k = 0; k < matchLength; k++) out[o + k] = src[k];
+		o += matchLength;
+	}
+	return o == n;
+}
+
+void FloatCodec::Compress(const float* values, int rows, int cols, std::vector<unsigned char>& out)
+{
+	size_t n = (size_t)rows * cols;
+	std::vector<unsigned char> planes(4 * n);
+	unsigned int prev = 0;
+	for (int row = 0; row < rows; row++)
+	{
+		for (int col = 0; col < cols; col++)
+		{
+			size_t i = (size_t)row * cols + col;
+			unsigned int bits;
+			memcpy(&bits, values + i, sizeof(bits));
+			if (col == 0 && row > 0) memcpy(&prev, values + i - cols, sizeof(prev));
+			unsigned int residual = bits ^ prev;
+			prev = bits;
+			planes[i] = (unsigned char)residual;
+			planes[n + i] = (unsigned char)(residual >> 8);
+			planes[2 * n + i] = (unsigned char)(residual >> 16);
+			planes[3 * n + i] = (unsigned char)(residual >> 24);
+		}
+	}
+
+	std::vector<unsigned char> packed(1 + 4 * n + 4 * n / 255 + 16);
+	size_t size = PackLZ(&planes[0], 4 * n, &packed[1]);
+	if (size < 4 * n)
+	{
+		packed[0] = BLOCK_PACKED;
+		out.assign(packed.begin(), packed.begin() + 1 + size);
+	}
+	else
+	{
+		//incompressible: keep the raw floats
+		out.resize(1 + 4 * n);
+		out[0] = BLOCK_RAW;
+		memcpy(&out[1], values, 4 * n);
+	}
+}
+
+bool FloatCodec::Decompress(const unsigned char* data, size_t size, int rows, int cols, float* values)
+{
+	size_t n = (size_t)rows * cols;
+	if (size < 1) return false;
+	if (data[0] == BLOCK_RAW)
+	{
+		if (size != 1 + 4 * n) return false;
+		memcpy(values, data + 1, 4 * n);
+		return true;
+	}
+	std::vector<unsigned char> planes(4 * n);
+	if (data[0] != BLOCK_PACKED || !UnpackLZ(data + 1, size - 1, &planes[0], 4 * n)) return false;
+
+	unsigned int prev = 0;
+	for (int row = 0; row < rows; row++)
+	{
+		for (int col = 0; col < cols; col++)
+		{
+			size_t i = (size_t)row * cols + col;
+			if (col == 0 && row > 0) memcpy(&prev, values + i - cols, sizeof(prev));
+			unsigned int residual = planes[i] | ((unsigned int)planes[n + i] << 8) |
+				((unsigned int)planes[2 * n + i] << 16) | ((unsigned int)planes[3 * n + i] << 24);
+			unsigned int bits = residual ^ prev;
+			memcpy(values + i, &bits, sizeof(bits));
+			prev = bits;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,27 @@
+#ifndef FLOAT_CODEC_HEAD_H
+#define FLOAT_CODEC_HEAD_H
+
+#include <vector>
+#include <stddef.h>
+
+/*
+*	Lossless codec for a rows x cols block of float elevations.
+*	Each value is XORed with its predecessor (left neighbour, or the cell
+*	above for the first column), so neighbouring elevations leave mostly
+*	zero high bytes. The residuals are split into four byte planes and the
+*	planes are packed with a small LZ77 coder in the LZ4 block style
+*	(token, literals, 16-bit offset, match length).
+*/
+class FloatCodec
+{
+public:
+	//replaces out with the compressed block
+	static void Compress(const float* values, int rows, int cols, std::vector<unsigned char>& out);
+	//false if the data is corrupt
+	static bool Decompress(const unsigned char* data, size_t size, int rows, int cols, float* values);
+private:
+	static size_t PackLZ(const unsigned char* in, size_t n, unsigned char* out);
+	static bool UnpackLZ(const unsigned char* in, size_t size, unsigned char* out, size_t n);
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "InPlaceUpdate.h"
+#include "FillDepth.h"
+#include "dem.h"
+#include "gdal_priv.h"
+#include "PhaseTrace.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+bool UpdateGeoTIFF(const char* path, const CDEM& dem, const FillDepth& changes,
+	double* min, double* max, double* mean, double* stdDev, const char* changeListPath, UpdateStats* stats)
+{
+	PhaseSpan span("update");
+	GDALAllRegister();
+	CPLSetConfigOption("GDAL_FILENAME_IS_UTF8", "NO");
+	GDALDataset* poDataset = (GDALDataset*)GDALOpen(path, GA_Update);
+	if (poDataset == NULL)
+	{
+		printf("Failed to open %s for update\n", path);
+		return false;
+	}
+	GDALRasterBand* poBand = poDataset->GetRasterBand(1);
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	if (poBand->GetXSize() != width || poBand->GetYSize() != height || poBand->GetRasterDataType() != GDT_Float32)
+	{
+		printf("%s is not the float raster that was filled\n", path);
+		GDALClose((GDALDatasetH)poDataset);
+		return false;
+	}
+	int blockX, blockY;
+	poBand->GetBlockSize(&blockX, &blockY);
+	int blocksPerRow = (width + blockX - 1) / blockX;
+	int blocksPerCol = (height + blockY - 1) / blockY;
+
+	FILE* changeList = NULL;
+	if (changeListPath != NULL && changeListPath[0] != '\0')
+	{
+		changeList = fopen(changeListPath, "wb");
+		if (changeList == NULL)
+		{
+			printf("Failed to create %s\n", changeListPath);
+			GDALClose((GDALDatasetH)poDataset);
+			return false;
+		}
+		int32_t header[4] = { width, height, blockX, blockY };
+		fwrite("FILLCHG1", 1, 8, changeList);
+		fwrite(header, sizeof(int32_t), 4, changeList);
+	}
+
+	std::vector<float> block((size_t)blockX * blockY);
+	UpdateStats counts = { (long long)blocksPerRow * blocksPerCol, 0, 0 };
+	CPLErr err = CE_None;
+	for (int by = 0; by < blocksPerCol && err == CE_None; by++)
+	{
+		int firstRow = by * blockY;
+		int rows = std::min(blockY, height - firstRow);
+		for (int bx = 0; bx < blocksPerRow && err == CE_None; bx++)
+		{
+			int firstCol = bx * blockX;
+			int cols = std::min(blockX, width - firstCol);
+			bool loaded = false;
+			uint32_t blockId = (uint32_t)((long long)by * blocksPerRow + bx);
+			for (int r = 0; r < rows && err == CE_None; r++)
+			{
+				for (int c = 0; c < cols; c++)
+				{
+					int row = firstRow + r, col = firstCol + c;
+					if (!changes.IsChanged(row, col)) continue;
+					if (!loaded)
+					{
+						err = poBand->ReadBlock(bx, by, &block[0]);
+						if (err != CE_None) break;
+						loaded = true;
+					}
+					uint32_t cell = (uint32_t)(r * blockX + c);
+					float z = dem.asFloat(row, col);
+					block[cell] = z;
+					counts.cellsChanged++;
+					if (changeList != NULL)
+					{
+						fwrite(&blockId, sizeof(uint32_t), 1, changeList);
+						fwrite(&cell, sizeof(uint32_t), 1, changeList);
+						fwrite(&z, sizeof(float), 1, changeList);
+					}
+				}
+			}
+			if (loaded && err == CE_None)
+			{
+				err = poBand->WriteBlock(bx, by, &block[0]);
+				counts.blocksWritten++;
+			}
+		}
+	}
+	if (err == CE_None && min != NULL && max != NULL && mean != NULL && stdDev != NULL)
+	{
+		poBand->SetStatistics(*min, *max, *mean, *stdDev);
+	}
+	if (changeList != NULL && fclose(changeList) != 0) err = CE_Failure;
+	GDALClose((GDALDatasetH)poDataset);
+	if (stats != NULL) *stats = counts;
+	printf("Updated %lld of %lld blocks (%lld cells)\n", counts.blocksWritten, counts.blocks, counts.cellsChanged);
+	return err == CE_None;
+}
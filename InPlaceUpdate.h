@@ -0,0 +1,30 @@
+#ifndef IN_PLACE_UPDATE_HEAD_H
+#define IN_PLACE_UPDATE_HEAD_H
+
+class CDEM;
+class FillDepth;
+
+struct UpdateStats
+{
+	long long blocks;
+	long long blocksWritten;
+	long long cellsChanged;
+};
+
+/*
+*	Writes a fill back into the GeoTIFF it was read from. The file is opened
+*	with GA_Update and only the GDAL blocks holding a changed cell (as recorded
+*	in changes) are rewritten: each such block is read, its changed cells are
+*	patched with the filled values and the block is written back, so every
+*	other cell, NoData encoding included, stays as it was in the file. With
+*	changeListPath set, the patched cells are also written as a sparse change
+*	list:
+*		"FILLCHG1", int32 width, height, blockXSize, blockYSize
+*		per cell: uint32 block id (row-major over blocks), uint32 cell index
+*		in the block (row-major), float32 new value
+*	in host byte order, sorted by block id then cell index.
+*/
+bool UpdateGeoTIFF(const char* path, const CDEM& dem, const FillDepth& changes,
+	double* min, double* max, double* mean, double* stdDev, const char* changeListPath, UpdateStats* stats);
+
+#endif
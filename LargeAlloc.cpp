@@ -0,0 +1,237 @@
+#include "LargeAlloc.h"
+#include <string.h>
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+static AllocPolicy allocPolicy;
+
+static const size_t HUGE_PAGE_BYTES = 2 << 20;
+//mappings start on a page boundary; other blocks are only looked up there
+static const size_t PAGE_BYTES = 4096;
+
+//mapped blocks by address, with the length that was mapped. The length is
+//kept out of line so the caller's memory starts on the mapping's (huge)
+//page boundary; blocks from operator new need no record.
+struct MappedBlocks
+{
+	std::mutex lock;
+	std::unordered_map<void*, size_t> lengths;
+};
+
+//never destroyed, so blocks freed by static destructors still find it
+static MappedBlocks& GetMappedBlocks()
+{
+	static MappedBlocks* blocks = new MappedBlocks();
+	return *blocks;
+}
+
+//set before the DEM is loaded; blocks keep the policy they were allocated with
+void SetAllocPolicy(const AllocPolicy& policy)
+{
+	allocPolicy = policy;
+}
+
+const AllocPolicy& GetAllocPolicy()
+{
+	return allocPolicy;
+}
+
+static size_t RoundUp(size_t bytes, size_t align)
+{
+	return (bytes + align - 1) / align * align;
+}
+
+//write one byte per page, each thread its own contiguous stripe
+static void TouchInStripes(char* p, size_t bytes, int threads)
+{
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < bytes; i += 4096) p[i] = 0;
+		return;
+	}
+	size_t stripe = RoundUp((bytes + threads - 1) / threads, 4096);
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; t++)
+	{
+		size_t first = (size_t)t * stripe;
+		if (first >= bytes) break;
+		size_t last = std::min(bytes, first + stripe);
+		workers.push_back(std::thread([p, first, last]() {
+			for (size_t i = first; i < last; i += 4096) p[i] = 0;
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+#ifdef _WIN32
+static void* MapPages(size_t& length, const AllocPolicy& policy)
+{
+	void* base = NULL;
+	if (policy.pages == ALLOC_PAGES_EXPLICIT_HUGE)
+	{
+		//needs SeLockMemoryPrivilege; Windows has no transparent huge pages
+		size_t large = GetLargePageMinimum();
+		if (large > 0)
+		{
+			size_t hugeLength = RoundUp(length, large);
+			base = VirtualAlloc(NULL, hugeLength, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (base != NULL) length = hugeLength;
+		}
+	}
+	if (base == NULL && policy.numa == ALLOC_NUMA_INTERLEAVE)
+	{
+		ULONG highestNode = 0;
+		GetNumaHighestNodeNumber(&highestNode);
+		base = VirtualAlloc(NULL, length, MEM_RESERVE, PAGE_READWRITE);
+		if (base != NULL)
+		{
+			//commit the range chunk by chunk, preferring the nodes in turn
+			for (size_t offset = 0; offset < length; offset += HUGE_PAGE_BYTES)
+			{
+				size_t chunk = std::min(HUGE_PAGE_BYTES, length - offset);
+				DWORD node = (DWORD)((offset / HUGE_PAGE_BYTES) % (highestNode + 1));
+				if (VirtualAllocExNuma(GetCurrentProcess(), (char*)base + offset, chunk,
+					MEM_COMMIT, PAGE_READWRITE, node) == NULL)
+				{
+					VirtualFree(base, 0, MEM_RELEASE);
+					base = NULL;
+					break;
+				}
+			}
+		}
+	}
+	if (base == NULL)
+	{
+		base = VirtualAlloc(NULL, length, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+	return base;
+}
+
+static void UnmapPages(void* base, size_t)
+{
+	VirtualFree(base, 0, MEM_RELEASE);
+}
+#else
+#ifdef __linux__
+//MPOL_INTERLEAVE over the nodes listed in /sys/devices/system/node/online
+static void InterleavePages(void* base, size_t length)
+{
+#ifdef SYS_mbind
+	const int maskBits = 1024;
+	unsigned long mask[maskBits / (8 * sizeof(unsigned long))];
+	memset(mask, 0, sizeof(mask));
+	FILE* fp = fopen("/sys/devices/system/node/online", "r");
+	if (fp == NULL) return;
+	int first, last;
+	char sep;
+	while (fscanf(fp, "%d", &first) == 1)
+	{
+		last = first;
+		if (fscanf(fp, "%c", &sep) == 1 && sep == '-')
+		{
+			if (fscanf(fp, "%d", &last) != 1) break;
+			if (fscanf(fp, "%c", &sep) != 1) sep = '\n';
+		}
+		for (int node = first; node <= last && node < maskBits; node++)
+			mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		if (sep != ',') break;
+	}
+	fclose(fp);
+	const int MPOL_INTERLEAVE_MODE = 3;
+	syscall(SYS_mbind, base, length, MPOL_INTERLEAVE_MODE, mask, (unsigned long)maskBits + 1, 0);
+#endif
+}
+#endif
+
+static void* MapPages(size_t& length, const AllocPolicy& policy)
+{
+	length = RoundUp(length, HUGE_PAGE_BYTES);
+	void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (policy.pages == ALLOC_PAGES_EXPLICIT_HUGE)
+	{
+		base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+#endif
+	if (base == MAP_FAILED)
+	{
+		//over-map and trim so the block starts on a huge page boundary
+		size_t over = length + HUGE_PAGE_BYTES;
+		char* raw = (char*)mmap(NULL, over, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == (char*)MAP_FAILED) return NULL;
+		char* aligned = (char*)RoundUp((size_t)raw, HUGE_PAGE_BYTES);
+		if (aligned > raw) munmap(raw, aligned - raw);
+		size_t tail = (raw + over) - (aligned + length);
+		if (tail > 0) munmap(aligned + length, tail);
+		base = aligned;
+#ifdef MADV_HUGEPAGE
+		if (policy.pages != ALLOC_PAGES_DEFAULT) madvise(base, length, MADV_HUGEPAGE);
+#endif
+	}
+#ifdef __linux__
+	if (policy.numa == ALLOC_NUMA_INTERLEAVE) InterleavePages(base, length);
+#endif
+	return base;
+}
+
+static void UnmapPages(void* base, size_t length)
+{
+	munmap(base, length);
+}
+#endif
+
+void* AllocLarge(size_t bytes, bool zero)
+{
+	const AllocPolicy& policy = allocPolicy;
+	bool mapped = bytes >= policy.minBytes &&
+		(policy.pages != ALLOC_PAGES_DEFAULT || policy.numa != ALLOC_NUMA_NONE);
+	if (!mapped)
+	{
+		char* p = new (std::nothrow) char[bytes];
+		if (p != NULL && zero) memset(p, 0, bytes);
+		return p;
+	}
+	size_t length = bytes;
+	//fresh mappings are zeroed by the OS
+	char* base = (char*)MapPages(length, policy);
+	if (base == NULL) return NULL;
+	if (policy.numa == ALLOC_NUMA_FIRST_TOUCH) TouchInStripes(base, length, policy.touchThreads);
+	MappedBlocks& blocks = GetMappedBlocks();
+	std::lock_guard<std::mutex> guard(blocks.lock);
+	blocks.lengths[base] = length;
+	return base;
+}
+
+void FreeLarge(void* p)
+{
+	if (p == NULL) return;
+	if ((size_t)p % PAGE_BYTES == 0)
+	{
+		MappedBlocks& blocks = GetMappedBlocks();
+		std::unique_lock<std::mutex> guard(blocks.lock);
+		std::unordered_map<void*, size_t>::iterator it = blocks.lengths.find(p);
+		if (it != blocks.lengths.end())
+		{
+			size_t length = it->second;
+			blocks.lengths.erase(it);
+			guard.unlock();
+			UnmapPages(p, length);
+			return;
+		}
+	}
+	delete[] (char*)p;
+}
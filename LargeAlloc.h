@@ -0,0 +1,77 @@
+#ifndef LARGE_ALLOC_HEAD_H
+#define LARGE_ALLOC_HEAD_H
+
+#include <stddef.h>
+#include <new>
+
+enum AllocPages
+{
+	//plain operator new, 4 KiB pages (the old behaviour)
+	ALLOC_PAGES_DEFAULT = 0,
+	//page-aligned mapping marked for transparent huge pages (madvise on Linux)
+	ALLOC_PAGES_TRANSPARENT_HUGE,
+	//reserved huge pages (MAP_HUGETLB / MEM_LARGE_PAGES), falls back to
+	//transparent huge pages when none are available
+	ALLOC_PAGES_EXPLICIT_HUGE
+};
+
+enum AllocNuma
+{
+	ALLOC_NUMA_NONE = 0,
+	//spread the pages round-robin over all NUMA nodes
+	ALLOC_NUMA_INTERLEAVE,
+	//touch the pages from touchThreads threads, one contiguous stripe each,
+	//so every stripe is placed on the node of the thread that will work on it
+	ALLOC_NUMA_FIRST_TOUCH
+};
+
+/*
+*	Placement policy of the large arrays: CDEM elevations and validity mask,
+*	Flag bits and the NodeQueue / RadixHeap storage. Blocks smaller than
+*	minBytes always come from operator new.
+*/
+struct AllocPolicy
+{
+	AllocPages pages;
+	AllocNuma numa;
+	int touchThreads;
+	size_t minBytes;
+	AllocPolicy()
+	{
+		pages = ALLOC_PAGES_DEFAULT;
+		numa = ALLOC_NUMA_NONE;
+		touchThreads = 0;
+		minBytes = 1 << 20;
+	}
+};
+
+void SetAllocPolicy(const AllocPolicy& policy);
+const AllocPolicy& GetAllocPolicy();
+
+//NULL on failure; zero = true returns zeroed memory
+void* AllocLarge(size_t bytes, bool zero = false);
+void FreeLarge(void* p);
+
+//std allocator on top of AllocLarge for the queue storage
+template <class T>
+class LargeAllocator
+{
+public:
+	typedef T value_type;
+	LargeAllocator() {}
+	template <class U> LargeAllocator(const LargeAllocator<U>&) {}
+	T* allocate(size_t n)
+	{
+		void* p = AllocLarge(n * sizeof(T));
+		if (p == NULL) throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T* p, size_t)
+	{
+		FreeLarge(p);
+	}
+	template <class U> bool operator==(const LargeAllocator<U>&) const { return true; }
+	template <class U> bool operator!=(const LargeAllocator<U>&) const { return false; }
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef NEIGHBOURHOOD_HEAD_H
+#define NEIGHBOURHOOD_HEAD_H
+
+/*
+*	Neighbourhood policies for the fill engines. The engines are templates
+*	on the policy: the offsets are constexpr and Count is a constant, so the
+*	neighbour loops can be unrolled. D8 keeps the order of ix / iy
+*	(E, SE, S, SW, W, NW, N, NE), so D8 fills are unchanged.
+*/
+struct D8
+{
+	static constexpr int Count = 8;
+	static constexpr int dRow[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+	static constexpr int dCol[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+};
+
+struct D4
+{
+	static constexpr int Count = 4;
+	static constexpr int dRow[4] = { 0, 1, 0, -1 };
+	static constexpr int dCol[4] = { 1, 0, -1, 0 };
+};
+
+enum Connectivity
+{
+	CONNECTIVITY_D8 = 0,
+	CONNECTIVITY_D4
+};
+
+template <class N>
+inline int Get_rowTo(int dir, int row)
+{
+	return row + N::dRow[dir];
+}
+
+template <class N>
+inline int Get_colTo(int dir, int col)
+{
+	return col + N::dCol[dir];
+}
+
+//every neighbour of an interior cell is inside the grid
+inline bool IsInterior(int row, int col, int width, int height)
+{
+	return (unsigned)(row - 1) < (unsigned)(height - 2) && (unsigned)(col - 1) < (unsigned)(width - 2);
+}
+
+#endif
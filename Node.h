@@ -1,6 +1,8 @@
 #ifndef NODE_HEAD_H
 #define NODE_HEAD_H
 #include <functional>
+//row and col stay 32-bit (GDAL band sizes are int), so a node is 12 bytes
+//whatever the grid size; only linear cell indices are 64-bit
 class Node
 {
 public:
@@ -0,0 +1,249 @@
+#include "ParallelTrace.h"
+#include "FillWorkspace.h"
+#include "progress.h"
+#include "PhaseTrace.h"
+#include <algorithm>
+#include <string>
+
+//a worker keeps its shared deque stocked once its FIFO holds this many cells
+static const size_t SHARE_GRAIN = 64;
+
+static bool ByPosition(const Node& a, const Node& b)
+{
+	return a.row < b.row || (a.row == b.row && a.col < b.col);
+}
+
+TracePool::TracePool()
+{
+	threads = 1;
+	minFront = 4096;
+	threadCount = 0;
+	workers = NULL;
+	shared = NULL;
+	generation = 0;
+	running = 0;
+	quit = false;
+	idle = 0;
+	kernel = NULL;
+	progress = NULL;
+	countBefore = 0;
+}
+
+TracePool::~TracePool()
+{
+	Stop();
+}
+
+void TracePool::SetThreads(int threads)
+{
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	this->threads = std::max(threads, 1);
+}
+
+int TracePool::GetThreads() const
+{
+	return threads;
+}
+
+void TracePool::SetMinFront(size_t nodes)
+{
+	minFront = std::max(nodes, (size_t)1);
+}
+
+bool TracePool::Usable(const CDEM& dem, const Flag& flag) const
+{
+	return threads > 1 && dem.GetBlocks() == NULL && flag.pager == NULL;
+}
+
+void TracePool::Start(int count)
+{
+	if (count == threadCount) return;
+	Stop();
+	threadCount = count;
+	workers = new TraceWorker[count];
+	shared = new SharedDeque[count];
+	quit = false;
+	generation = 0;
+	for (int t = 1; t < count; t++)
+	{
+		pool.push_back(std::thread(&TracePool::Loop, this, t));
+	}
+}
+
+void TracePool::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(runLock);
+		quit = true;
+	}
+	wake.notify_all();
+	for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+	pool.clear();
+	delete[] workers;
+	delete[] shared;
+	workers = NULL;
+	shared = NULL;
+	threadCount = 0;
+}
+
+//pool threads sleep between traces
+void TracePool::Loop(int id)
+{
+	unsigned long long seen = 0;
+	std::string name = "trace worker " + std::to_string(id);
+	SetPhaseThreadName(name.c_str());
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(runLock);
+			wake.wait(lock, [&]() { return quit || generation != seen; });
+			if (quit) return;
+			seen = generation;
+		}
+		Work(id);
+		std::lock_guard<std::mutex> lock(runLock);
+		if (--running == 0) done.notify_one();
+	}
+}
+
+void TracePool::Work(int id)
+{
+	//one span per worker and trace
+	PhaseSpan span("trace");
+	TraceWorker& worker = workers[id];
+	Node node;
+	long long traced = 0;
+	while (Next(id, node))
+	{
+		kernel->Expand(node, worker);
+		traced++;
+		if ((traced & 1023) == 0)
+		{
+			worker.traced.store(traced, std::memory_order_relaxed);
+			if (id == 0) progress->Poll(countBefore + Traced());
+		}
+		if (worker.local.size() - worker.head >= SHARE_GRAIN && shared[id].size.load(std::memory_order_relaxed) == 0) Share(id);
+	}
+	worker.traced.store(traced, std::memory_order_relaxed);
+}
+
+//the next cell from the private FIFO, the own deque or another worker's
+//deque; false once every worker is out of work
+bool TracePool::Next(int id, Node& node)
+{
+	TraceWorker& worker = workers[id];
+	if (worker.head >= 4096 && worker.head * 2 >= worker.local.size())
+	{
+		//drop the finished half so the FIFO does not keep the whole trace
+		worker.local.erase(worker.local.begin(), worker.local.begin() + worker.head);
+		worker.head = 0;
+	}
+	else if (worker.head == worker.local.size())
+	{
+		worker.local.clear();
+		worker.head = 0;
+	}
+	if (worker.local.empty() && !Take(id, id))
+	{
+		//a worker counts as idle while it holds no cells, so when all of
+		//them are idle no cell is left anywhere
+		idle++;
+		bool found = false;
+		while (!found)
+		{
+			if (idle.load() == threadCount) return false;
+			for (int k = 1; k < threadCount && !found; k++)
+			{
+				int victim = (id + k) % threadCount;
+				if (shared[victim].size.load() == 0) continue;
+				idle--;
+				if (Take(victim, id)) found = true;
+				else idle++;
+			}
+			if (!found) std::this_thread::yield();
+		}
+	}
+	node = worker.local[worker.head++];
+	return true;
+}
+
+//all of the own deque, half of another worker's
+bool TracePool::Take(int from, int id)
+{
+	SharedDeque& deque = shared[from];
+	std::lock_guard<std::mutex> lock(deque.lock);
+	size_t n = deque.nodes.size();
+	if (n == 0) return false;
+	size_t take = from == id ? n : (n + 1) / 2;
+	std::vector<Node>& local = workers[id].local;
+	local.insert(local.end(), deque.nodes.end() - take, deque.nodes.end());
+	deque.nodes.resize(n - take);
+	deque.size.store(n - take);
+	return true;
+}
+
+//move the newer half of the FIFO to the shared deque
+void TracePool::Share(int id)
+{
+	TraceWorker& worker = workers[id];
+	size_t half = (worker.local.size() - worker.head) / 2;
+	SharedDeque& deque = shared[id];
+	std::lock_guard<std::mutex> lock(deque.lock);
+	deque.nodes.insert(deque.nodes.end(), worker.local.end() - half, worker.local.end());
+	deque.size.store(deque.nodes.size());
+	worker.local.resize(worker.local.size() - half);
+}
+
+long long TracePool::Traced() const
+{
+	long long traced = 0;
+	for (int t = 0; t < threadCount; t++) traced += workers[t].traced.load(std::memory_order_relaxed);
+	return traced;
+}
+
+long long TracePool::Run(TraceKernel& kernel, NodeQueue& traceQueue, ProgressSink& progress, long long count)
+{
+	Start(threads);
+	for (int t = 0; t < threadCount; t++)
+	{
+		workers[t].local.clear();
+		workers[t].head = 0;
+		workers[t].spill.clear();
+		workers[t].potential.clear();
+		workers[t].traced.store(0);
+	}
+	//deal the front out in contiguous runs; the queue keeps neighbours together
+	size_t front = traceQueue.size();
+	for (size_t i = 0; i < front; i++)
+	{
+		workers[i * threadCount / front].local.push_back(traceQueue.front());
+		traceQueue.pop();
+	}
+
+	this->kernel = &kernel;
+	this->progress = &progress;
+	countBefore = count;
+	idle = 0;
+	{
+		std::lock_guard<std::mutex> lock(runLock);
+		running = threadCount - 1;
+		generation++;
+	}
+	wake.notify_all();
+	Work(0);
+	{
+		std::unique_lock<std::mutex> lock(runLock);
+		done.wait(lock, [&]() { return running == 0; });
+	}
+
+	spillCells.clear();
+	potentialCells.clear();
+	for (int t = 0; t < threadCount; t++)
+	{
+		spillCells.insert(spillCells.end(), workers[t].spill.begin(), workers[t].spill.end());
+		potentialCells.insert(potentialCells.end(), workers[t].potential.begin(), workers[t].potential.end());
+	}
+	std::sort(spillCells.begin(), spillCells.end(), ByPosition);
+	std::sort(potentialCells.begin(), potentialCells.end(), ByPosition);
+	return Traced();
+}
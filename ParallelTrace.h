@@ -0,0 +1,115 @@
+#ifndef PARALLEL_TRACE_HEAD_H
+#define PARALLEL_TRACE_HEAD_H
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "Node.h"
+
+class CDEM;
+class Flag;
+class NodeQueue;
+class ProgressSink;
+class TraceWorker;
+
+//expands one slope cell; called from every worker at the same time, so it
+//may only claim cells through Flag::ClaimFlag and must not write the DEM
+class TraceKernel
+{
+public:
+	virtual ~TraceKernel() {}
+	virtual void Expand(const Node& node, TraceWorker& worker) = 0;
+};
+
+//per-thread state passed to TraceKernel::Expand
+class alignas(64) TraceWorker
+{
+	friend class TracePool;
+private:
+	//the worker's own FIFO, cells before head are done
+	std::vector<Node> local;
+	size_t head;
+	std::vector<Node> spill;
+	std::vector<Node> potential;
+	std::atomic<long long> traced;
+public:
+	TraceWorker() : head(0), traced(0) {}
+	//a slope cell this worker has claimed; it is traced further
+	void Push(const Node& node) { local.push_back(node); }
+	//a potential spill cell for the priority queue
+	void Spill(const Node& node) { spill.push_back(node); }
+	//Wei's potential spill cells, rechecked after the trace
+	void Potential(const Node& node) { potential.push_back(node); }
+};
+
+/*
+*	Work-stealing executor for the slope traces of the Zhou and Wei variants.
+*	A trace front of at least minFront cells is split over the workers. Each
+*	worker traces breadth first from a private FIFO, as the serial trace
+*	does (depth first order finds many more potential spill cells), and
+*	moves the newer half of it to its shared deque when that runs dry; idle
+*	workers steal half of another worker's deque. Cells are claimed with an atomic
+*	Flag::ClaimFlag, so each one is traced once. The spill cells of all
+*	workers are merged in (row, col) order, which does not depend on the
+*	thread that found them. The calling thread is worker 0.
+*/
+class TracePool
+{
+private:
+	struct alignas(64) SharedDeque
+	{
+		std::mutex lock;
+		std::vector<Node> nodes;
+		std::atomic<size_t> size;
+		SharedDeque() : size(0) {}
+	};
+	int threads;
+	size_t minFront;
+	int threadCount;
+	TraceWorker* workers;
+	SharedDeque* shared;
+	std::vector<std::thread> pool;
+	std::mutex runLock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned long long generation;
+	int running;
+	bool quit;
+	std::atomic<int> idle;
+	TraceKernel* kernel;
+	ProgressSink* progress;
+	long long countBefore;
+	std::vector<Node> spillCells;
+	std::vector<Node> potentialCells;
+
+	void Start(int count);
+	void Loop(int id);
+	void Work(int id);
+	bool Next(int id, Node& node);
+	bool Take(int from, int id);
+	void Share(int id);
+	long long Traced() const;
+public:
+	TracePool();
+	~TracePool();
+	//0 uses every hardware thread; 1 (the default) keeps tracing serial
+	void SetThreads(int threads);
+	int GetThreads() const;
+	//fronts smaller than this are traced on the calling thread
+	void SetMinFront(size_t nodes);
+	size_t GetMinFront() const { return minFront; }
+	//parallel tracing needs more than one thread, a flat DEM and in-memory flags
+	bool Usable(const CDEM& dem, const Flag& flag) const;
+	//traces traceQueue to the end and returns the number of cells traced;
+	//count is the engine's progress count before the call
+	long long Run(TraceKernel& kernel, NodeQueue& traceQueue, ProgressSink& progress, long long count);
+	//results of the last Run, sorted by (row, col)
+	const std::vector<Node>& GetSpillCells() const { return spillCells; }
+	const std::vector<Node>& GetPotentialCells() const { return potentialCells; }
+	//joins the worker threads; they are started again by the next Run
+	void Stop();
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "PhaseTrace.h"
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <map>
+
+struct PhaseEvent
+{
+	const char* name;
+	int thread;
+	double start;
+	double duration;
+};
+
+static std::atomic<bool> traceEnabled(false);
+static std::mutex traceLock;
+static std::vector<PhaseEvent> traceEvents;
+static std::map<int, std::string> threadNames;
+static std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+static std::atomic<int> nextThread(1);
+
+//small stable ids read better in the viewers than native thread ids
+static int PhaseThread()
+{
+	thread_local int id = nextThread++;
+	return id;
+}
+
+void EnablePhaseTrace(bool enable)
+{
+	if (enable) SetPhaseThreadName("main");
+	traceEnabled.store(enable);
+}
+
+bool PhaseTraceEnabled()
+{
+	return traceEnabled.load(std::memory_order_relaxed);
+}
+
+void ClearPhaseTrace()
+{
+	std::lock_guard<std::mutex> lock(traceLock);
+	traceEvents.clear();
+	traceEpoch = std::chrono::steady_clock::now();
+}
+
+void SetPhaseThreadName(const char* name)
+{
+	int id = PhaseThread();
+	std::lock_guard<std::mutex> lock(traceLock);
+	threadNames[id] = name;
+}
+
+double PhaseSpan::End()
+{
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	open = false;
+	double seconds = std::chrono::duration<double>(end - start).count();
+	if (PhaseTraceEnabled())
+	{
+		PhaseEvent event;
+		event.name = name;
+		event.thread = PhaseThread();
+		event.duration = seconds * 1e6;
+		std::lock_guard<std::mutex> lock(traceLock);
+		event.start = std::chrono::duration<double, std::micro>(start - traceEpoch).count();
+		traceEvents.push_back(event);
+	}
+	return seconds;
+}
+
+//names are identifiers of this program, only quotes and backslashes need escaping
+static void WriteJsonString(FILE* fp, const char* text)
+{
+	fputc('"', fp);
+	for (; *text; text++)
+	{
+		if (*text == '"' || *text == '\\') fputc('\\', fp);
+		fputc(*text, fp);
+	}
+	fputc('"', fp);
+}
+
+//Chrome trace event format: "X" events with ts / dur in microseconds
+bool WritePhaseTrace(const char* path)
+{
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		printf("Failed to write the phase trace %s\n", path);
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(traceLock);
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Priority_flood_algorithms\"}}");
+	for (std::map<int, std::string>::const_iterator it = threadNames.begin(); it != threadNames.end(); ++it)
+	{
+		fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", it->first);
+		WriteJsonString(fp, it->second.c_str());
+		fprintf(fp, "}}");
+	}
+	for (size_t i = 0; i < traceEvents.size(); i++)
+	{
+		const PhaseEvent& event = traceEvents[i];
+		fprintf(fp, ",\n{\"name\":");
+		WriteJsonString(fp, event.name);
+		fprintf(fp, ",\"cat\":\"fill\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			event.thread, event.start, event.duration);
+	}
+	fprintf(fp, "\n]}\n");
+	bool ok = ferror(fp) == 0;
+	return fclose(fp) == 0 && ok;
+}
@@ -0,0 +1,36 @@
+#ifndef PHASE_TRACE_HEAD_H
+#define PHASE_TRACE_HEAD_H
+
+#include <chrono>
+
+/*
+*	Phase timing trace. Every PhaseSpan measures its lifetime on the steady
+*	clock; while the trace is enabled it is also recorded as a complete
+*	event of the calling thread. WritePhaseTrace exports the events as
+*	Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open
+*	directly. Spans of one thread nest by time, so a span opened inside
+*	another one shows up below it.
+*/
+void EnablePhaseTrace(bool enable);
+bool PhaseTraceEnabled();
+//drops the recorded events and restarts the trace clock
+void ClearPhaseTrace();
+//names the calling thread in the trace
+void SetPhaseThreadName(const char* name);
+bool WritePhaseTrace(const char* path);
+
+class PhaseSpan
+{
+private:
+	//must be a string literal, the trace keeps the pointer
+	const char* name;
+	std::chrono::steady_clock::time_point start;
+	bool open;
+public:
+	explicit PhaseSpan(const char* name) : name(name), start(std::chrono::steady_clock::now()), open(true) {}
+	~PhaseSpan() { if (open) End(); }
+	//closes the span before the end of the scope; returns its length in seconds
+	double End();
+};
+
+#endif
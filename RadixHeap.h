@@ -0,0 +1,135 @@
+#ifndef RADIX_HEAP_HEAD_H
+#define RADIX_HEAP_HEAD_H
+
+#include <vector>
+#include <string.h>
+#include <assert.h>
+#include "Node.h"
+#include "LargeAlloc.h"
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//map a float to an unsigned key with the same ordering (-0.0f sorts just below 0.0f)
+inline unsigned int FloatToOrderedKey(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+//inverse of FloatToOrderedKey
+inline float OrderedKeyToFloat(unsigned int key)
+{
+	unsigned int bits = (key & 0x80000000u) ? (key & 0x7FFFFFFFu) : ~key;
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+//number of significant bits of x, 0 for x == 0
+inline int RadixBitLength(unsigned int x)
+{
+	if (x == 0) return 0;
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, x);
+	return (int)index + 1;
+#else
+	return 32 - __builtin_clz(x);
+#endif
+}
+
+/*
+*	Monotone radix heap keyed on the order-preserving uint32 image of Node::spill.
+*	Priority-Flood never pushes a cell lower than the last popped spill, which is
+*	all the radix heap needs; pops are then amortised O(1) bucket moves instead of
+*	O(log n) sift-downs. Interface matches std::priority_queue<Node, ..., Node::Greater>
+*	so it can stand in for the PriorityQueue typedef of the engines.
+*/
+class RadixHeap
+{
+private:
+	std::vector<Node, LargeAllocator<Node> > buckets[33];
+	unsigned int last;
+	size_t count;
+
+	inline static unsigned int KeyOf(const Node& node)
+	{
+		return FloatToOrderedKey(node.spill);
+	}
+
+	//move the smallest non-empty bucket down so that bucket 0 holds the minimum
+	void Redistribute()
+	{
+		int i = 1;
+		while (buckets[i].empty()) i++;
+		std::vector<Node, LargeAllocator<Node> >& bucket = buckets[i];
+		unsigned int newLast = KeyOf(bucket[0]);
+		for (size_t j = 1; j < bucket.size(); j++)
+		{
+			unsigned int key = KeyOf(bucket[j]);
+			if (key < newLast) newLast = key;
+		}
+		last = newLast;
+		for (size_t j = 0; j < bucket.size(); j++)
+		{
+			buckets[RadixBitLength(KeyOf(bucket[j]) ^ last)].push_back(bucket[j]);
+		}
+		bucket.clear();
+	}
+public:
+	RadixHeap()
+	{
+		last = 0;
+		count = 0;
+	}
+	bool empty() const
+	{
+		return count == 0;
+	}
+	size_t size() const
+	{
+		return count;
+	}
+	void push(const Node& node)
+	{
+		unsigned int key = KeyOf(node);
+		//monotone heap: nothing may be lower than the last popped key
+		assert(key >= last);
+		buckets[RadixBitLength(key ^ last)].push_back(node);
+		count++;
+	}
+	const Node& top()
+	{
+		if (buckets[0].empty()) Redistribute();
+		return buckets[0].back();
+	}
+	//true if another node is at spill, the key of the last top(); unlike
+	//top() it never moves on to a higher key, so cells between spill and
+	//the next key can still be pushed
+	bool hasAt(float spill) const
+	{
+		return !buckets[0].empty() && KeyOf(buckets[0].back()) == FloatToOrderedKey(spill);
+	}
+	void pop()
+	{
+		if (buckets[0].empty()) Redistribute();
+		buckets[0].pop_back();
+		count--;
+	}
+	//appends every node, in no particular order, for a checkpoint
+	void CopyTo(std::vector<Node>& nodes) const
+	{
+		for (int i = 0; i < 33; i++) nodes.insert(nodes.end(), buckets[i].begin(), buckets[i].end());
+	}
+	//drop the nodes but keep the bucket capacity for the next fill
+	void clear()
+	{
+		for (int i = 0; i < 33; i++) buckets[i].clear();
+		last = 0;
+		count = 0;
+	}
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef TERRAIN_PROFILE_HEAD_H
+#define TERRAIN_PROFILE_HEAD_H
+
+#include <string>
+
+/*
+*	Cheap terrain statistics for picking a fill engine. ProfileTerrain reads
+*	PROFILE_SAMPLES evenly spaced rows of the GeoTIFF (with the rows above and
+*	below them) and profiles the cells of the sampled rows against their
+*	eight neighbours; the DEM itself is not loaded.
+*/
+#define PROFILE_SAMPLES 64
+
+struct TerrainProfile
+{
+	int width, height;
+	long long sampledCells;
+	long long validCells;
+	//valid cells strictly lower than all their neighbours, over valid cells
+	double minimaFraction;
+	//neighbour pairs of equal elevation, over all valid neighbour pairs
+	double flatFraction;
+	double noDataFraction;
+	//valid cells next to NoData or the grid edge, over valid cells
+	double borderFraction;
+};
+
+enum FillEngine
+{
+	FILL_ENGINE_WANG = 0,
+	FILL_ENGINE_BARNES,
+	FILL_ENGINE_ZHOU_ONEPASS,
+	FILL_ENGINE_ZHOU_TWOPASS,
+	FILL_ENGINE_ZHOU_DIRECT,
+	FILL_ENGINE_WEI
+};
+
+bool ProfileTerrain(const char* path, TerrainProfile& profile);
+//picks the engine for a profile; reasons explains the choice for the log
+FillEngine ChooseFillEngine(const TerrainProfile& profile, std::string& reasons);
+const char* FillEngineName(FillEngine engine);
+
+#endif
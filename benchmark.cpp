@@ -0,0 +1,246 @@
+#include <iostream>
+#include <queue>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <math.h>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+#include "RadixHeap.h"
+#include "ExternalPriorityQueue.h"
+using namespace std;
+
+typedef std::vector<Node> NodeVector;
+typedef std::priority_queue<Node, NodeVector, Node::Greater> StdPriorityQueue;
+
+//ExternalPriorityQueue held to 1 MB, so the benchmark fills spill to disk
+class SpillingQueue : public ExternalPriorityQueue
+{
+public:
+	SpillingQueue()
+	{
+		SetMemoryBudget(1 << 20);
+	}
+};
+
+//synthetic terrain: "flat" is quantised to whole metres so most cells sit in plateaus
+//and depressions, "rough" is a tilted surface with sub-metre noise
+static void MakeTerrain(CDEM& dem, int width, int height, bool flat, unsigned int seed)
+{
+	dem.SetWidth(width);
+	dem.SetHeight(height);
+	dem.Allocate();
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+	for (int row = 0; row < height; row++)
+	{
+		for (int col = 0; col < width; col++)
+		{
+			float z = 0.01f * row + 0.02f * col + 5.0f * (float)(sin(row * 0.05) * cos(col * 0.07));
+			if (flat) z = floorf(z + noise(rng) * 3.0f);
+			else z += noise(rng) * 10.0f;
+			dem.Set_Value(row, col, z);
+		}
+	}
+}
+
+//plain Priority-Flood (Wang & Liu) on the given queue type, returns seconds
+template <class Queue>
+static double PriorityFlood(CDEM& dem)
+{
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	Flag flag;
+	flag.Init(width, height);
+	auto timeStart = std::chrono::high_resolution_clock::now();
+	Queue queue;
+	Node tmpNode;
+	for (int row = 0; row < height; row++)
+	{
+		for (int col = 0; col < width; col++)
+		{
+			if (row == 0 || row == height - 1 || col == 0 || col == width - 1)
+			{
+				tmpNode.row = row;
+				tmpNode.col = col;
+				tmpNode.spill = dem.asFloat(row, col);
+				queue.push(tmpNode);
+				flag.SetFlag(row, col);
+			}
+		}
+	}
+	while (!queue.empty())
+	{
+		Node node = queue.top();
+		queue.pop();
+		for (int i = 0; i < 8; i++)
+		{
+			int iRow = Get_rowTo(i, node.row);
+			int iCol = Get_colTo(i, node.col);
+			if (flag.IsProcessed(iRow, iCol)) continue;
+			float iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill < node.spill) iSpill = node.spill;
+			dem.Set_Value(iRow, iCol, iSpill);
+			flag.SetFlag(iRow, iCol);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = iSpill;
+			queue.push(tmpNode);
+		}
+	}
+	std::chrono::duration<double> consumeTime = std::chrono::high_resolution_clock::now() - timeStart;
+	return consumeTime.count();
+}
+
+//compare std::priority_queue, RadixHeap and a spilling ExternalPriorityQueue
+//on flat-heavy and rough terrain
+void BenchmarkPriorityQueues(int width, int height)
+{
+	const char* names[2] = { "flat-heavy", "rough" };
+	for (int t = 0; t < 2; t++)
+	{
+		CDEM demStd, demRadix, demExternal;
+		MakeTerrain(demStd, width, height, t == 0, 20260101u);
+		MakeTerrain(demRadix, width, height, t == 0, 20260101u);
+		MakeTerrain(demExternal, width, height, t == 0, 20260101u);
+		double timeStd = PriorityFlood<StdPriorityQueue>(demStd);
+		double timeRadix = PriorityFlood<RadixHeap>(demRadix);
+		double timeExternal = PriorityFlood<SpillingQueue>(demExternal);
+
+		long long diff = 0;
+		for (int row = 0; row < height; row++)
+			for (int col = 0; col < width; col++)
+				if (demStd.asFloat(row, col) != demRadix.asFloat(row, col) ||
+					demStd.asFloat(row, col) != demExternal.asFloat(row, col)) diff++;
+
+		cout << names[t] << " " << width << " x " << height
+			<< "  std::priority_queue: " << timeStd << " s"
+			<< "  RadixHeap: " << timeRadix << " s"
+			<< "  speedup: " << timeStd / timeRadix
+			<< "  ExternalPriorityQueue (1 MB): " << timeExternal << " s"
+			<< "  differing cells: " << diff << endl;
+	}
+}
+
+//set-associative LRU cache model used to count misses of an address trace
+class CacheModel
+{
+private:
+	int sets, ways, lineShift;
+	std::vector<unsigned long long> tags;
+	std::vector<unsigned long long> stamps;
+	unsigned long long clock;
+public:
+	long long accesses, misses;
+	CacheModel(int sizeBytes, int ways, int lineShift)
+	{
+		this->ways = ways;
+		this->lineShift = lineShift;
+		sets = (sizeBytes >> lineShift) / ways;
+		tags.assign((size_t)sets * ways, ~0ULL);
+		stamps.assign((size_t)sets * ways, 0);
+		clock = 0;
+		accesses = misses = 0;
+	}
+	void Access(unsigned long long address)
+	{
+		unsigned long long line = address >> lineShift;
+		size_t set = (size_t)(line % sets) * ways;
+		accesses++;
+		clock++;
+		size_t victim = set;
+		for (int w = 0; w < ways; w++)
+		{
+			if (tags[set + w] == line)
+			{
+				stamps[set + w] = clock;
+				return;
+			}
+			if (stamps[set + w] < stamps[victim]) victim = set + w;
+		}
+		misses++;
+		tags[victim] = line;
+		stamps[victim] = clock;
+	}
+};
+
+//L1D (32 KiB, 8-way), L2 (1 MiB, 16-way) and a 64-entry 4-way DTLB on 4 KiB pages
+struct LayoutModel
+{
+	CacheModel l1, l2, tlb;
+	LayoutModel() : l1(32 << 10, 8, 6), l2(1 << 20, 16, 6), tlb(64 << 12, 4, 12) {}
+	void Access(unsigned long long address)
+	{
+		l1.Access(address);
+		l2.Access(address);
+		tlb.Access(address);
+	}
+};
+
+//replay the DEM and Flag accesses of a Priority-Flood through the cache
+//model for the row-major and the tiled (DEM_TILED_LAYOUT) cell order
+void BenchmarkLayouts(int width, int height)
+{
+	CDEM dem;
+	MakeTerrain(dem, width, height, false, 20260101u);
+	const unsigned long long flagBase = 1ULL << 40;
+	int tilesPerRow = (width + DEM_TILE_SIZE - 1) >> DEM_TILE_SHIFT;
+	LayoutModel rowMajor, tiled;
+
+	std::vector<unsigned char> flag((size_t)width * height, 0);
+	RadixHeap queue;
+	Node tmpNode;
+	for (int row = 0; row < height; row++)
+	{
+		for (int col = 0; col < width; col++)
+		{
+			if (row == 0 || row == height - 1 || col == 0 || col == width - 1)
+			{
+				tmpNode.row = row;
+				tmpNode.col = col;
+				tmpNode.spill = dem.asFloat(row, col);
+				queue.push(tmpNode);
+				flag[(size_t)row * width + col] = 1;
+			}
+		}
+	}
+	while (!queue.empty())
+	{
+		Node node = queue.top();
+		queue.pop();
+		for (int i = 0; i < 8; i++)
+		{
+			int iRow = Get_rowTo(i, node.row);
+			int iCol = Get_colTo(i, node.col);
+			if (iRow < 0 || iRow >= height || iCol < 0 || iCol >= width) continue;
+			size_t rm = (size_t)iRow * width + iCol;
+			size_t tl = TiledIndex(iRow, iCol, tilesPerRow);
+			rowMajor.Access(flagBase + rm / 8);
+			tiled.Access(flagBase + tl / 8);
+			if (flag[rm]) continue;
+			rowMajor.Access(rm * sizeof(float));
+			tiled.Access(tl * sizeof(float));
+			float iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill < node.spill) iSpill = node.spill;
+			dem.Set_Value(iRow, iCol, iSpill);
+			flag[rm] = 1;
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = iSpill;
+			queue.push(tmpNode);
+		}
+	}
+
+	const char* names[2] = { "row-major", "tiled 32x32" };
+	LayoutModel* models[2] = { &rowMajor, &tiled };
+	cout << "Priority-Flood on " << width << " x " << height << " rough terrain, "
+		<< rowMajor.l1.accesses << " DEM/Flag accesses" << endl;
+	for (int i = 0; i < 2; i++)
+	{
+		cout << names[i]
+			<< "  L1 misses: " << models[i]->l1.misses
+			<< "  L2 misses: " << models[i]->l2.misses
+			<< "  TLB misses: " << models[i]->tlb.misses << endl;
+	}
+}
@@ -1,18 +1,55 @@
 #include "dem.h" // CDEM  
 #include "utils.h" // ܰһЩߺsetNoData  
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <new>
+#include "BlockCache.h"
+#include "FillDepth.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEM_USE_SSE2
+#endif
 
 // CDEMAllocateڷڴ߳  
-bool CDEM::Allocate()
+bool CDEM::Allocate(bool fillNoData)
 {
-	delete[] pDem; // ͷ֮ǰڴ棨У  
-	pDem = new float[width * height]; // ݿȺ͸߶ȷµڴ  
+	if (storage != DEM_STORAGE_FLAT)
+	{
+		FreeLarge(pDem);
+		pDem = NULL;
+		capacity = 0;
+		delete blocks;
+		blocks = NULL;
+		//unwritten blocks read as NO_DATA_VALUE, there is nothing to prefill
+		if (storage == DEM_STORAGE_COMPRESSED)
+		{
+			CompressedBlockStore* store = new (std::nothrow) CompressedBlockStore();
+			blocks = store;
+			return store != NULL && store->Init(width, height, cacheBlocks);
+		}
+		PagedBlockStore* store = new (std::nothrow) PagedBlockStore();
+		blocks = store;
+		return store != NULL && store->Init(width, height, cacheBlocks, scratchPath);
+	}
+	delete blocks;
+	blocks = NULL;
+	tilesPerRow = (width + DEM_TILE_SIZE - 1) >> DEM_TILE_SHIFT;
+	size_t length = Get_Length();
+	//keep the buffer when a DEM of the same size is loaded again
+	if (pDem == NULL || capacity != length)
+	{
+		FreeLarge(pDem);
+		pDem = (float*)AllocLarge(length * sizeof(float));
+		capacity = pDem != NULL ? length : 0;
+	}
 	if (pDem == NULL) // ڴǷɹ  
 	{
 		return false; // ʧܣfalse  
 	}
 	else
 	{
-		setNoData(pDem, width * height, NO_DATA_VALUE); // ʼֵΪNO_DATA_VALUE  
+		if (fillNoData) setNoData(pDem, capacity, NO_DATA_VALUE); // ʼֵΪNO_DATA_VALUE  
 		return true; // ɹtrue  
 	}
 }
@@ -20,39 +57,292 @@ bool CDEM::Allocate()
 // CDEMfreeMemͷڴ  
 void CDEM::freeMem()
 {
-	delete[] pDem; // ͷڴ  
+	FreeLarge(pDem); // ͷڴ  
 	pDem = NULL; // ָΪNULLָ  
+	capacity = 0;
+	delete blocks;
+	blocks = NULL;
+	FreeLarge(validMask);
+	validMask = NULL;
+	maskWords = 0;
+}
+
+void CDEM::SetStorage(DemStorage storage, int cacheBlocks)
+{
+	this->storage = storage;
+	this->cacheBlocks = cacheBlocks;
+}
+
+void CDEM::SetCacheBudget(size_t bytes)
+{
+	size_t blockBytes = (size_t)DEM_BLOCK_SIZE * DEM_BLOCK_SIZE * sizeof(float);
+	cacheBlocks = (int)std::max((size_t)1, bytes / blockBytes);
+}
+
+int CDEM::GetCacheBlocks() const
+{
+	return cacheBlocks;
+}
+
+void CDEM::SetScratchPath(const std::string& path)
+{
+	scratchPath = path;
+}
+
+const std::string& CDEM::GetScratchPath() const
+{
+	return scratchPath;
+}
+
+DemStorage CDEM::GetStorage() const
+{
+	return storage;
+}
+
+BlockCache* CDEM::GetBlocks() const
+{
+	return blocks;
+}
+
+bool CDEM::IsRowMajor() const
+{
+#ifdef DEM_TILED_LAYOUT
+	return false;
+#else
+	return blocks == NULL;
+#endif
+}
+
+int CDEM::StripRows() const
+{
+	if (blocks != NULL) return DEM_BLOCK_SIZE;
+	return DEM_TILE_SIZE;
+}
+
+//map the file's nodata value (and NaN) onto NO_DATA_VALUE so that the rest of
+//the code only has to recognise one value; values within 1e-5 of
+//NO_DATA_VALUE are snapped to it exactly, as is_NoData treated them before
+void CDEM::NormalizeNoData(bool hasNoData, float fileNoData)
+{
+	if (blocks != NULL)
+	{
+		std::vector<float> strip((size_t)StripRows() * width);
+		for (int row = 0; row < height; row += StripRows())
+		{
+			int rowCount = std::min(StripRows(), height - row);
+			blocks->GetRows(row, rowCount, &strip[0]);
+			NormalizeNoData(&strip[0], (size_t)rowCount * width, hasNoData, fileNoData);
+			blocks->SetRows(row, rowCount, &strip[0]);
+		}
+		return;
+	}
+	NormalizeNoData(pDem, capacity, hasNoData, fileNoData);
+}
+
+//same on a plain buffer, used by readTIFF on each strip as it is read
+void CDEM::NormalizeNoData(float* values, size_t n, bool hasNoData, float fileNoData)
+{
+	bool noDataIsNaN = hasNoData && fileNoData != fileNoData;
+	for (size_t i = 0; i < n; i++)
+	{
+		float v = values[i];
+		if (v != v || (hasNoData && !noDataIsNaN && v == fileNoData) || fabs(v - NO_DATA_VALUE) < 0.00001)
+		{
+			values[i] = NO_DATA_VALUE;
+		}
+	}
+}
+
+//OR n (<= 64) bits into the mask starting at bit position pos
+static inline void SetMaskBits(unsigned long long* mask, size_t pos, unsigned long long bits, int n)
+{
+	size_t word = pos >> 6;
+	int shift = (int)(pos & 63);
+	mask[word] |= bits << shift;
+	if (shift + n > 64) mask[word + 1] |= bits >> (64 - shift);
+}
+
+//set the mask bits of a run of n contiguous cells of one row
+static void SetValidBits(unsigned long long* mask, size_t pos, const float* line, int n)
+{
+	int col = 0;
+#ifdef DEM_USE_SSE2
+	//16 cells per step: four compares, four movemasks, one or two word updates
+	const __m128 noData = _mm_set1_ps(NO_DATA_VALUE);
+	for (; col + 16 <= n; col += 16, pos += 16)
+	{
+		unsigned long long bits = (unsigned long long)_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(line + col), noData));
+		bits |= (unsigned long long)_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(line + col + 4), noData)) << 4;
+		bits |= (unsigned long long)_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(line + col + 8), noData)) << 8;
+		bits |= (unsigned long long)_mm_movemask_ps(_mm_cmpneq_ps(_mm_loadu_ps(line + col + 12), noData)) << 12;
+		SetMaskBits(mask, pos, bits, 16);
+	}
+#endif
+	for (; col < n; col++, pos++)
+	{
+		if (line[col] != NO_DATA_VALUE) mask[pos >> 6] |= 1ULL << (pos & 63);
+	}
+}
+
+//rebuild the validity mask from the elevations, NO_DATA_VALUE cells are invalid
+bool CDEM::BuildValidMask()
+{
+	size_t stride = (size_t)width + 2;
+	size_t words = (stride * ((size_t)height + 2) + 63) / 64;
+	if (validMask == NULL || maskWords != words)
+	{
+		FreeLarge(validMask);
+		validMask = (unsigned long long*)AllocLarge(words * sizeof(unsigned long long));
+		if (validMask == NULL)
+		{
+			maskWords = 0;
+			return false;
+		}
+		maskWords = words;
+	}
+	memset(validMask, 0, words * sizeof(unsigned long long));
+
+	if (blocks != NULL)
+	{
+		std::vector<float> strip((size_t)StripRows() * width);
+		for (int row = 0; row < height; row += StripRows())
+		{
+			int rowCount = std::min(StripRows(), height - row);
+			blocks->GetRows(row, rowCount, &strip[0]);
+			for (int r = 0; r < rowCount; r++)
+			{
+				SetValidBits(validMask, (size_t)(row + r + 1) * stride + 1, &strip[(size_t)r * width], width);
+			}
+		}
+		return true;
+	}
+	for (int row = 0; row < height; row++)
+	{
+		size_t pos = (size_t)(row + 1) * stride + 1;
+#ifdef DEM_TILED_LAYOUT
+		//a row is contiguous only within each tile
+		for (int col = 0; col < width; col += DEM_TILE_SIZE)
+		{
+			int n = std::min(DEM_TILE_SIZE, width - col);
+			SetValidBits(validMask, pos + col, pDem + Index(row, col), n);
+		}
+#else
+		SetValidBits(validMask, pos, pDem + (size_t)row * width, width);
+#endif
+	}
+	return true;
+}
+
+size_t CDEM::Get_Length() const
+{
+#ifdef DEM_TILED_LAYOUT
+	size_t tilesPerCol = ((size_t)height + DEM_TILE_SIZE - 1) >> DEM_TILE_SHIFT;
+	return ((size_t)tilesPerRow * tilesPerCol) << (2 * DEM_TILE_SHIFT);
+#else
+	return (size_t)width * height;
+#endif
+}
+
+//copy rowCount full rows starting at firstRow into a row-major buffer
+void CDEM::GetRows(int firstRow, int rowCount, float* rows) const
+{
+	if (blocks != NULL)
+	{
+		blocks->GetRows(firstRow, rowCount, rows);
+		return;
+	}
+#ifdef DEM_TILED_LAYOUT
+	for (int r = 0; r < rowCount; r++)
+	{
+		for (int col = 0; col < width; col += DEM_TILE_SIZE)
+		{
+			int n = std::min(DEM_TILE_SIZE, width - col);
+			memcpy(rows + (size_t)r * width + col, pDem + Index(firstRow + r, col), n * sizeof(float));
+		}
+	}
+#else
+	memcpy(rows, pDem + (size_t)firstRow * width, (size_t)rowCount * width * sizeof(float));
+#endif
+}
+
+//inverse of GetRows
+void CDEM::SetRows(int firstRow, int rowCount, const float* rows)
+{
+	if (blocks != NULL)
+	{
+		blocks->SetRows(firstRow, rowCount, rows);
+		return;
+	}
+#ifdef DEM_TILED_LAYOUT
+	for (int r = 0; r < rowCount; r++)
+	{
+		for (int col = 0; col < width; col += DEM_TILE_SIZE)
+		{
+			int n = std::min(DEM_TILE_SIZE, width - col);
+			memcpy(pDem + Index(firstRow + r, col), rows + (size_t)r * width + col, n * sizeof(float));
+		}
+	}
+#else
+	memcpy(pDem + (size_t)firstRow * width, rows, (size_t)rowCount * width * sizeof(float));
+#endif
 }
 
 // CDEMinitialElementsNodataڽԪسʼΪNO_DATA_VALUE  
 void CDEM::initialElementsNodata()
 {
-	setNoData(pDem, width * height, NO_DATA_VALUE); // ùߺгʼ  
+	//fresh block storage reads as NO_DATA_VALUE everywhere
+	if (blocks != NULL)
+	{
+		Allocate();
+		return;
+	}
+	setNoData(pDem, capacity, NO_DATA_VALUE); // ùߺгʼ  
 }
 
 // CDEMasFloatڻȡָλõĸֵ߳  
 float CDEM::asFloat(int row, int col) const
 {
-	return pDem[row * width + col]; // мظֵ߳  
+	if (blocks != NULL) return blocks->Get(row, col);
+	return pDem[Index(row, col)]; // мظֵ߳  
 }
 
 // CDEMSet_Valueָλõĸֵ߳  
 void CDEM::Set_Value(int row, int col, float z)
 {
-	pDem[row * width + col] = z; // мøֵ߳  
+	if (fillDepth != NULL)
+	{
+		float from = asFloat(row, col);
+		if (z != from && from != NO_DATA_VALUE) fillDepth->Record(row, col, from, z);
+	}
+	if (blocks != NULL)
+	{
+		blocks->Set(row, col, z);
+		return;
+	}
+	pDem[Index(row, col)] = z; // мøֵ߳  
+}
+
+void CDEM::SetFillDepth(FillDepth* depth)
+{
+	fillDepth = depth;
 }
 
 // CDEMis_NoDataڼָλǷΪNO_DATA_VALUE  
 bool CDEM::is_NoData(int row, int col) const
 {
-	if (fabs(pDem[row * width + col] - NO_DATA_VALUE) < 0.00001) return true; // ȽǷӽNO_DATA_VALUE  
+	if (fabs(asFloat(row, col) - NO_DATA_VALUE) < 0.00001) return true; // ȽǷӽNO_DATA_VALUE  
 	return false;
 }
 
 // CDEMAssign_NoDataڽԪΪNO_DATA_VALUE  
 void CDEM::Assign_NoData()
 {
-	for (int i = 0; i < width * height; i++)
+	if (blocks != NULL)
+	{
+		Allocate();
+		return;
+	}
+	for (size_t i = 0; i < capacity; i++)
 		pDem[i] = NO_DATA_VALUE; // 鲢ֵ  
 }
 
@@ -91,7 +381,17 @@ void CDEM::readDEM(const std::string& filePath)
 {
 	std::ifstream is;
 	is.open(filePath, std::ios::binary); // Զģʽļ  
-	is.read((char*)pDem, sizeof(float) * width * height); // ȡݵڴ  
+	if (!IsRowMajor())
+	{
+		std::vector<float> line(width);
+		for (int row = 0; row < height; row++)
+		{
+			is.read((char*)&line[0], sizeof(float) * width);
+			SetRows(row, 1, &line[0]);
+		}
+	}
+	else
+		is.read((char*)pDem, sizeof(float) * Get_Length()); // ȡݵڴ  
 	is.close(); // رļ  
 }
 
@@ -6,9 +6,26 @@
 #include <fstream>
 #include <queue>
 #include <functional>
+#include "LargeAlloc.h"
 
 #define NO_DATA_VALUE -9999.0f
 
+/*
+*	Define DEM_TILED_LAYOUT to store CDEM and Flag in square tiles of
+*	DEM_TILE_SIZE x DEM_TILE_SIZE cells instead of row-major order. A 32 x 32
+*	float tile is one 4 KiB page, so the eight neighbours of most cells share
+*	a page and vertical neighbours are 128 bytes apart instead of a full row.
+*	Rows are converted at read/write time (GetRows/SetRows).
+*/
+#define DEM_TILE_SHIFT 5
+#define DEM_TILE_SIZE (1 << DEM_TILE_SHIFT)
+
+inline size_t TiledIndex(int row, int col, int tilesPerRow)
+{
+	size_t tile = (size_t)(row >> DEM_TILE_SHIFT) * tilesPerRow + (col >> DEM_TILE_SHIFT);
+	return (tile << (2 * DEM_TILE_SHIFT)) + ((row & (DEM_TILE_SIZE - 1)) << DEM_TILE_SHIFT) + (col & (DEM_TILE_SIZE - 1));
+}
+
 
 /*
 *	reverse of flow directions
@@ -24,27 +41,107 @@ static unsigned char inverse[8] = { 16, 32, 64, 128, 1, 2, 4, 8 };
 *	8	4	2
 */
 static unsigned char	dir[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+//where CDEM keeps its elevations, chosen before Allocate / readTIFF
+enum DemStorage
+{
+	//one float array (row-major or tiled)
+	DEM_STORAGE_FLAT = 0,
+	//compressed blocks behind a cache of decoded hot blocks (BlockCache.h)
+	DEM_STORAGE_COMPRESSED,
+	//out of core: raw blocks in a scratch file behind an LRU block cache
+	DEM_STORAGE_PAGED
+};
+
+class BlockCache;
+class FillDepth;
 class CDEM
 {
 protected:
 	float* pDem;
+	DemStorage storage;
+	int cacheBlocks;
+	std::string scratchPath;
+	//set instead of pDem for block storage
+	BlockCache* blocks;
 	int width, height;
+	//floats allocated in pDem; size_t so grids beyond 2^31 cells work
+	size_t capacity;
+	int tilesPerRow;
+	//one bit per cell, set for valid cells, with a one-cell invalid frame
+	//around the grid so neighbour probes need no bounds check
+	unsigned long long* validMask;
+	size_t maskWords;
+	//set while a fill records its depth, see FillDepth.h
+	FillDepth* fillDepth;
 public:
 	CDEM()
 	{
 		pDem = NULL;
+		storage = DEM_STORAGE_FLAT;
+		cacheBlocks = 0;
+		blocks = NULL;
+		width = 0;
+		height = 0;
+		capacity = 0;
+		tilesPerRow = 0;
+		validMask = NULL;
+		maskWords = 0;
+		fillDepth = NULL;
 	}
 	~CDEM()
 	{
-		delete[] pDem;
+		freeMem();
 	}
-	bool Allocate();
+	//cacheBlocks is the number of decoded blocks kept for block storage,
+	//0 picks BlockCache::DefaultCacheBlocks
+	void SetStorage(DemStorage storage, int cacheBlocks = 0);
+	//cache size of block storage as a memory budget in bytes
+	void SetCacheBudget(size_t bytes);
+	int GetCacheBlocks() const;
+	//scratch file of DEM_STORAGE_PAGED (the paged Flags add ".flag1",
+	//".flag2"); empty uses an anonymous temporary file
+	void SetScratchPath(const std::string& path);
+	const std::string& GetScratchPath() const;
+	DemStorage GetStorage() const;
+	BlockCache* GetBlocks() const;
+	//true when pDem holds the grid row by row
+	bool IsRowMajor() const;
+	//rows per strip for streaming I/O through GetRows / SetRows
+	int StripRows() const;
+	//fillNoData = false skips the NO_DATA_VALUE prefill when every cell is
+	//about to be overwritten (readTIFF)
+	bool Allocate(bool fillNoData = true);
 
 	void freeMem();
+	//position of a cell in pDem for the compiled layout
+	inline size_t Index(int row, int col) const
+	{
+#ifdef DEM_TILED_LAYOUT
+		return TiledIndex(row, col, tilesPerRow);
+#else
+		return (size_t)row * width + col;
+#endif
+	}
+	//number of floats in pDem, including tile padding
+	size_t Get_Length() const;
+	void GetRows(int firstRow, int rowCount, float* rows) const;
+	void SetRows(int firstRow, int rowCount, const float* rows);
+	void NormalizeNoData(bool hasNoData, float fileNoData);
+	static void NormalizeNoData(float* values, size_t n, bool hasNoData, float fileNoData);
+	bool BuildValidMask();
+	//row in [-1, height] and col in [-1, width]; needs BuildValidMask()
+	inline bool is_Valid(int row, int col) const
+	{
+		size_t index = (size_t)(row + 1) * (width + 2) + (col + 1);
+		return (validMask[index >> 6] >> (index & 63)) & 1;
+	}
 
 	void initialElementsNodata();
 	float asFloat(int row, int col) const;
 	void Set_Value(int row, int col, float z);
+	//Set_Value reports every changed valid cell to depth; NULL stops it
+	void SetFillDepth(FillDepth* depth);
 	bool is_NoData(int row, int col) const;
 	void Assign_NoData();
 	int Get_NY() const;
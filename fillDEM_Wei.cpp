@@ -6,6 +6,9 @@
 #include "dem.h"
 #include "Node.h"
 #include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "PhaseTrace.h"
 #include <time.h>
 #include <list>
 #include <stack>
@@ -13,19 +16,17 @@
 #include <chrono>
 using namespace std;
 
-typedef std::vector<Node> NodeVector;
-typedef std::priority_queue<Node, NodeVector, Node::Greater> PriorityQueue;
-
 size_t priorityNodes2 = 0;   // ȶд洢Ľڵֵ
 
-void InitPriorityQue(CDEM& dem, Flag& flag, PriorityQueue& priorityQueue)
+template <class NB>
+void InitPriorityQue(CDEM& dem, Flag& flag, PriorityQueue& priorityQueue, ProgressSink& progress)
 {
+	PhaseSpan span("border seeding");
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
 	Node tmpNode;
 	int iRow, iCol, row, col;
-
-	queue<Node> depressionQue;
+	long long noDataCount = 0;
 
 	// push border cells into the PQ
 	for (row = 0; row < height; row++)
@@ -34,14 +35,15 @@ void InitPriorityQue(CDEM& dem, Flag& flag, PriorityQueue& priorityQueue)
 		{
 			if (flag.IsProcessedDirect(row, col)) continue;
 
-			if (dem.is_NoData(row, col)) {
+			if (!dem.is_Valid(row, col)) {
+				noDataCount++;
 				flag.SetFlag(row, col);
-				for (int i = 0; i < 8; i++)
+				for (int i = 0; i < NB::Count; i++)
 				{
-					iRow = Get_rowTo(i, row);
-					iCol = Get_colTo(i, col);
+					iRow = Get_rowTo<NB>(i, row);
+					iCol = Get_colTo<NB>(i, col);
 					if (flag.IsProcessed(iRow, iCol)) continue;
-					if (!dem.is_NoData(iRow, iCol))
+					if (dem.is_Valid(iRow, iCol))
 					{
 						tmpNode.row = iRow;
 						tmpNode.col = iCol;
@@ -66,27 +68,90 @@ void InitPriorityQue(CDEM& dem, Flag& flag, PriorityQueue& priorityQueue)
 			}
 		}
 	}
+	progress.SetTotal((long long)width * height - noDataCount);
 }
 
-void ProcessTraceQue(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQueue& priorityQueue)
+template <class NB>
+class WeiTraceKernel : public TraceKernel
+{
+public:
+	CDEM& dem;
+	Flag& flag;
+	WeiTraceKernel(CDEM& dem, Flag& flag) : dem(dem), flag(flag) {}
+	//one step of ProcessTraceQue with atomic flags
+	virtual void Expand(const Node& node, TraceWorker& worker)
+	{
+		int indexThreshold = NB::Count / 4;
+		Node N;
+		bool Mask[5][5] = { {false},{false},{false},{false},{false} };
+		for (int i = 0; i < NB::Count; i++) {
+			int iRow = Get_rowTo<NB>(i, node.row);
+			int iCol = Get_colTo<NB>(i, node.col);
+			if (flag.IsProcessedAtomic(iRow, iCol)) continue;
+			float iSpill = dem.asFloat(iRow, iCol);
+			if (iSpill > node.spill) {
+				//another worker may have claimed N in the meantime
+				if (!flag.ClaimFlag(iRow, iCol)) continue;
+				N.col = iCol;
+				N.row = iRow;
+				N.spill = iSpill;
+				worker.Push(N);
+				continue;
+			}
+			bool HaveSpillPathOrLowerSpillOutlet = false;
+			for (int k = 0; k < NB::Count; k++) {
+				int kRow = Get_rowTo<NB>(k, iRow);
+				int kCol = Get_colTo<NB>(k, iCol);
+				if ((Mask[kRow - node.row + 2][kCol - node.col + 2]) ||
+					(flag.IsProcessedAtomic(kRow, kCol) && dem.asFloat(kRow, kCol) < node.spill))
+				{
+					Mask[iRow - node.row + 2][iCol - node.col + 2] = true;
+					HaveSpillPathOrLowerSpillOutlet = true;
+					break;
+				}
+			}
+			if (!HaveSpillPathOrLowerSpillOutlet) {
+				if (i < indexThreshold) worker.Potential(node);
+				else worker.Spill(node);
+				break;
+			}
+		}
+	}
+};
+
+template <class NB>
+void ProcessTraceQue(CDEM& dem, Flag& flag, NodeQueue& traceQueue, NodeQueue& potentialQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress, TracePool& tracePool)
 {
 	bool HaveSpillPathOrLowerSpillOutlet;
 	int i, iRow, iCol;
 	int k, kRow, kCol;
 	int noderow, nodecol;
 	Node N, node;
-	queue<Node> potentialQueue;
-	int indexThreshold = 2;  //index threshold, default to 2
+	int indexThreshold = NB::Count / 4;  //index threshold, 2 for D8 (1 for D4)
 	while (!traceQueue.empty())
 	{
+		if (traceQueue.size() >= tracePool.GetMinFront() && tracePool.Usable(dem, flag))
+		{
+			//a large front: trace the rest of it on all workers
+			WeiTraceKernel<NB> kernel(dem, flag);
+			count += tracePool.Run(kernel, traceQueue, progress, count);
+			const vector<Node>& spillCells = tracePool.GetSpillCells();
+			for (size_t k = 0; k < spillCells.size(); k++) priorityQueue.push(spillCells[k]);
+			priorityNodes2 += spillCells.size();
+			const vector<Node>& potentialCells = tracePool.GetPotentialCells();
+			for (size_t k = 0; k < potentialCells.size(); k++) potentialQueue.push(potentialCells[k]);
+			break;
+		}
 		node = traceQueue.front();
 		traceQueue.pop();
+		count++;
+		progress.Poll(count);
 		noderow = node.row;
 		nodecol = node.col;
 		bool Mask[5][5] = { {false},{false},{false},{false},{false} };
-		for (i = 0; i < 8; i++) {
-			iRow = Get_rowTo(i, noderow);
-			iCol = Get_colTo(i, nodecol);
+		for (i = 0; i < NB::Count; i++) {
+			iRow = Get_rowTo<NB>(i, noderow);
+			iCol = Get_colTo<NB>(i, nodecol);
 			if (flag.IsProcessedDirect(iRow, iCol)) continue;
 			if (dem.asFloat(iRow, iCol) > node.spill) {
 				N.col = iCol;
@@ -98,9 +163,9 @@ void ProcessTraceQue(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQue
 			else {
 				//initialize all masks as false		
 				HaveSpillPathOrLowerSpillOutlet = false; //whether cell i has a spill path or a lower spill outlet than node if i is a depression cell
-				for (k = 0; k < 8; k++) {
-					kRow = Get_rowTo(k, iRow);
-					kCol = Get_colTo(k, iCol);
+				for (k = 0; k < NB::Count; k++) {
+					kRow = Get_rowTo<NB>(k, iRow);
+					kCol = Get_colTo<NB>(k, iCol);
 					if ((Mask[kRow - noderow + 2][kCol - nodecol + 2]) ||
 						(flag.IsProcessedDirect(kRow, kCol) && dem.asFloat(kRow, kCol) < node.spill)
 						)
@@ -131,10 +196,10 @@ void ProcessTraceQue(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQue
 		nodecol = node.col;
 
 		//first case
-		for (i = 0; i < 8; i++)
+		for (i = 0; i < NB::Count; i++)
 		{
-			iRow = Get_rowTo(i, noderow);
-			iCol = Get_colTo(i, nodecol);
+			iRow = Get_rowTo<NB>(i, noderow);
+			iCol = Get_colTo<NB>(i, nodecol);
 			if (flag.IsProcessedDirect(iRow, iCol)) continue;
 			else {
 				priorityQueue.push(node);
@@ -145,8 +210,9 @@ void ProcessTraceQue(CDEM& dem, Flag& flag, queue<Node>& traceQueue, PriorityQue
 	}
 }
 
-void ProcessPit(CDEM& dem, Flag& flag, queue<Node>& depressionQue,
-	queue<Node>& traceQueue, PriorityQueue& priorityQueue)
+template <class NB>
+void ProcessPit(CDEM& dem, Flag& flag, NodeQueue& depressionQue,
+	NodeQueue& traceQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress)
 {
 	int iRow, iCol, i;
 	float iSpill;
@@ -158,10 +224,12 @@ void ProcessPit(CDEM& dem, Flag& flag, queue<Node>& depressionQue,
 	{
 		node = depressionQue.front();
 		depressionQue.pop();
-		for (i = 0; i < 8; i++)
+		count++;
+		progress.Poll(count);
+		for (i = 0; i < NB::Count; i++)
 		{
-			iRow = Get_rowTo(i, node.row);
-			iCol = Get_colTo(i, node.col);
+			iRow = Get_rowTo<NB>(i, node.row);
+			iCol = Get_colTo<NB>(i, node.col);
 			if (flag.IsProcessedDirect(iRow, iCol)) continue;
 			iSpill = dem.asFloat(iRow, iCol);
 			if (iSpill > node.spill)
@@ -184,12 +252,55 @@ void ProcessPit(CDEM& dem, Flag& flag, queue<Node>& depressionQue,
 	}
 }
 
-void fillDEM(const char* inputFile, const char* outputFilledPath)
+//handles the unprocessed neighbours of a cell taken from the PQ; interior cells skip the bounds checks
+template <class NB, bool Interior>
+static void ProcessNeighbours(CDEM& dem, Flag& flag, NodeQueue& depressionQue, NodeQueue& traceQueue, NodeQueue& potentialQueue, PriorityQueue& priorityQueue, long long& count, ProgressSink& progress, TracePool& tracePool, int row, int col, float spill)
+{
+	int iRow, iCol;
+	float iSpill;
+	Node tmpNode;
+	for (int i = 0; i < NB::Count; i++)
+	{
+		iRow = Get_rowTo<NB>(i, row);
+		iCol = Get_colTo<NB>(i, col);
+
+		if (flag.IsProcessedAt<Interior>(iRow, iCol)) continue;
+		iSpill = dem.asFloat(iRow, iCol);
+		if (iSpill <= spill) {
+			//depression cell
+			dem.Set_Value(iRow, iCol, spill);
+			flag.SetFlag(iRow, iCol);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = spill;
+			depressionQue.push(tmpNode);
+			ProcessPit<NB>(dem, flag, depressionQue, traceQueue, priorityQueue, count, progress);
+		}
+		else
+		{
+			//slope cell
+			flag.SetFlag(iRow, iCol);
+			tmpNode.row = iRow;
+			tmpNode.col = iCol;
+			tmpNode.spill = iSpill;
+			traceQueue.push(tmpNode);
+		}
+		ProcessTraceQue<NB>(dem, flag, traceQueue, potentialQueue, priorityQueue, count, progress, tracePool);
+	}
+}
+
+template <class NB>
+static void fillDEM_Impl(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
 {
-	queue<Node> traceQueue;
-	queue<Node> depressionQue;
+	PhaseSpan run("fillDEM");
+	ProgressSink consoleProgress;
+	if (progress == NULL) progress = &consoleProgress;
+	FillWorkspace localWorkspace;
+	if (workspace == NULL) workspace = &localWorkspace;
+	NodeQueue& traceQueue = workspace->traceQueue;
+	NodeQueue& depressionQue = workspace->depressionQue;
 	//read float-type DEM
-	CDEM dem;
+	CDEM& dem = workspace->dem;
 	double geoTransformArgs[6];
 	std::cout << "Reading input tiff file..." << endl;
 	if (!readTIFF(inputFile, GDALDataType::GDT_Float32, dem, geoTransformArgs)) {
@@ -201,66 +312,55 @@ void fillDEM(const char* inputFile, const char* outputFilledPath)
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
 	std::cout << "Using our proposed variant to fill DEM" << endl;
-	auto timeStart = std::chrono::high_resolution_clock::now();
-	Flag flag;
-	if (!flag.Init(width, height)) {
+	PhaseSpan fillSpan("fill");
+	if (!workspace->Prepare(width, height)) {
 		printf("Failed to allocate memory!\n");
 		return;
 	}
-	PriorityQueue priorityQueue;
-	int iRow, iCol, row, col;
-	float iSpill, spill;
+	Flag& flag = workspace->flag;
+	PriorityQueue& priorityQueue = workspace->priorityQueue;
+	int row, col;
+	float spill;
 
 	int numberofall = 0;
 	int numberofright = 0;
+	//cells are counted when they leave the depression or trace queue
+	long long count = 0;
 
-	InitPriorityQue(dem, flag, priorityQueue);
+	InitPriorityQue<NB>(dem, flag, priorityQueue, *progress);
 	while (!priorityQueue.empty())
 	{
+		if (!progress->Poll(count)) break;
 		Node tmpNode = priorityQueue.top();
 		priorityQueue.pop();
 		row = tmpNode.row;
 		col = tmpNode.col;
 		spill = tmpNode.spill;
 
-		for (int i = 0; i < 8; i++)
-		{
-			iRow = Get_rowTo(i, row);
-			iCol = Get_colTo(i, col);
-
-			if (flag.IsProcessed(iRow, iCol)) continue;
-			iSpill = dem.asFloat(iRow, iCol);
-			if (iSpill <= spill) {
-				//depression cell
-				dem.Set_Value(iRow, iCol, spill);
-				flag.SetFlag(iRow, iCol);
-				tmpNode.row = iRow;
-				tmpNode.col = iCol;
-				tmpNode.spill = spill;
-				depressionQue.push(tmpNode);
-				ProcessPit(dem, flag, depressionQue, traceQueue, priorityQueue);
-			}
-			else
-			{
-				//slope cell
-				flag.SetFlag(iRow, iCol);
-				tmpNode.row = iRow;
-				tmpNode.col = iCol;
-				tmpNode.spill = iSpill;
-				traceQueue.push(tmpNode);
-			}
-			ProcessTraceQue(dem, flag, traceQueue, priorityQueue);
-		}
+		if (IsInterior(row, col, width, height)) ProcessNeighbours<NB, true>(dem, flag, depressionQue, traceQueue, workspace->traceQueue2, priorityQueue, count, *progress, workspace->tracePool, row, col, spill);
+		else ProcessNeighbours<NB, false>(dem, flag, depressionQue, traceQueue, workspace->traceQueue2, priorityQueue, count, *progress, workspace->tracePool, row, col, spill);
+	}
+	progress->Finish(count);
+	if (progress->Stopped())
+	{
+		cout << "\nFilling stopped: " << progress->GetStatusText() << endl;
+		return;
 	}
 	// ¼ʱ  
-	auto timeEnd = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<double> consumeTime = timeEnd - timeStart;
-	cout << "Time used:" << consumeTime.count() << " seconds" << endl;
+	double consumeTime = fillSpan.End();
+	cout << "Time used:" << consumeTime << " seconds" << endl;
 	std::cout << "\n===== ȶдĽڵ =====\n" << priorityNodes2 << "\n";
 	double min, max, mean, stdDev;
 	calculateStatistics(dem, &min, &max, &mean, &stdDev);
-	CreateGeoTIFF(outputFilledPath, dem.Get_NY(), dem.Get_NX(),
-		(void*)dem.getDEMdata(), GDALDataType::GDT_Float32, geoTransformArgs,
+	workspace->WriteOutput(outputFilledPath, geoTransformArgs,
 		&min, &max, &mean, &stdDev, -9999);
 	return;
-}
\ No newline at end of file
+}
+
+void fillDEM(const char* inputFile, const char* outputFilledPath, ProgressSink* progress, FillWorkspace* workspace)
+{
+	if (workspace != NULL && workspace->connectivity == CONNECTIVITY_D4)
+		fillDEM_Impl<D4>(inputFile, outputFilledPath, progress, workspace);
+	else
+		fillDEM_Impl<D8>(inputFile, outputFilledPath, progress, workspace);
+}
@@ -3,6 +3,10 @@
 #include "dem.h"
 #include "Node.h"
 #include "utils.h"
+#include "progress.h"
+#include "FillWorkspace.h"
+#include "FillDEM_Breach.h"
+#include "PhaseTrace.h"
 #include <time.h>
 #include <list>
 #include <unordered_map>
@@ -22,22 +26,33 @@ using std::priority_queue;
 using std::binary_function;
 
 
-typedef std::vector<Node> NodeVector;
-typedef std::priority_queue<Node, NodeVector, Node::Greater> PriorityQueue;
-
-void FillDEM_Zhou_OnePass(const char* inputFile, const char* outputFilledPath);
-int FillDEM_Wang(const char* inputFile, const char* outputFilledPath);
-int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath);
-void FillDEM_Zhou_TwoPass(const char* inputFile, const char* outputFilledPath);
-void FillDEM_Zhou_Direct(const char* inputFile, const char* outputFilledPath);
+//progress == NULL reports to the console only, workspace == NULL allocates a private one
+void FillDEM_Zhou_OnePass(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+int FillDEM_Wang(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+int FillDEM_Barnes(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+void FillDEM_Zhou_TwoPass(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+void FillDEM_Zhou_Direct(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+void fillDEM(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+int FillDEM_PD(const char* inputFile, const char* outputFilledPath);
+int FillDEM_Vincent(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+int FillDEM_Wavefront(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+int FillDEM_SortUnion(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+//continues the fill of a snapshot of Checkpoint.h
+int FillDEM_Resume(const char* checkpointPath, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+//profiles the DEM and runs the engine that suits it (TerrainProfile.h)
+int FillDEM_Auto(const char* inputFile, const char* outputFilledPath, ProgressSink* progress = NULL, FillWorkspace* workspace = NULL);
+void BenchmarkPriorityQueues(int width, int height);
+void BenchmarkLayouts(int width, int height);
+void BenchmarkPrimitives(const int* sizes, int sizeCount, const char* filter);
 
 // һڼָ߳ģͣDEMͳϢ
 void calculateStatistics(const CDEM& dem, double* min, double* max, double* mean, double* stdDev)
 {
+	PhaseSpan span("statistics");
 	int width = dem.Get_NX();
 	int height = dem.Get_NY();
 
-	int validElements = 0;
+	long long validElements = 0;
 	double minValue, maxValue;
 	double sum = 0.0;
 	double sumSqurVal = 0.0;
@@ -87,6 +102,9 @@ int main() {
 
     std::string filename = "D:\\GIS_Data\\aktin1.tif";//E:\\gdal2.3.1-vc2019\\test.tifD:\\ASTGTM_N32E104B.imgD:\\dem_3m_m1.img
     std::string outputFilename = "D:\\GIS_Data\\dem_di.tif";
+    //non-empty: write a Chrome trace of the run's phases (open it in ui.perfetto.dev)
+    std::string tracePath = "";
+    EnablePhaseTrace(!tracePath.empty());
     
     int m = 3;
     
@@ -102,9 +120,53 @@ int main() {
 	else if (m == 4) {
 		FillDEM_Zhou_TwoPass(filename.c_str(), outputFilename.c_str());
 	}
+	else if (m == 5) {
+		fillDEM(filename.c_str(), outputFilename.c_str());
+	}
+	else if (m == 6) {
+		FillDEM_PD(filename.c_str(), outputFilename.c_str());
+	}
+	else if (m == 0) {
+		FillDEM_Auto(filename.c_str(), outputFilename.c_str());
+	}
+	else if (m == 7) {
+		BenchmarkPriorityQueues(4000, 4000);
+	}
+	else if (m == 8) {
+		BenchmarkLayouts(20000, 1000);
+	}
+	else if (m == 9) {
+		//microbenchmarks of the fill primitives; a non-empty filter runs the matching cases only
+		int sizes[3] = { 256, 1024, 4096 };
+		BenchmarkPrimitives(sizes, 3, "");
+	}
+	else if (m == 10) {
+		FillDEM_Breach(filename.c_str(), outputFilename.c_str());
+	}
+	else if (m == 11) {
+		FillDEM_Wavefront(filename.c_str(), outputFilename.c_str());
+	}
+	else if (m == 12) {
+		FillDEM_SortUnion(filename.c_str(), outputFilename.c_str());
+	}
+	else if (m == 13) {
+		FillDEM_Vincent(filename.c_str(), outputFilename.c_str());
+	}
+	else if (m == 14) {
+		//Barnes with a snapshot every 10 minutes; run again after an interruption to resume
+		std::string checkpointPath = "D:\\GIS_Data\\fill.ckp";
+		FillWorkspace workspace;
+		workspace.checkpoint.SetPath(checkpointPath);
+		workspace.checkpoint.SetInterval(600);
+		if (ifstream(checkpointPath.c_str()).good())
+			FillDEM_Resume(checkpointPath.c_str(), outputFilename.c_str(), NULL, &workspace);
+		else
+			FillDEM_Barnes(filename.c_str(), outputFilename.c_str(), NULL, &workspace);
+	}
 	else {
 		FillDEM_Zhou_Direct(filename.c_str(), outputFilename.c_str());
 	}
+	if (!tracePath.empty()) WritePhaseTrace(tracePath.c_str());
     
  
     return 0;
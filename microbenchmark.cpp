@@ -0,0 +1,266 @@
+#include <iostream>
+#include <iomanip>
+#include <queue>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <string.h>
+#include "dem.h"
+#include "Node.h"
+#include "utils.h"
+using namespace std;
+
+/*
+*	Microbenchmarks of the primitives the engines are built from. Every case
+*	works on a size x size raster, is set up outside the timed region and is
+*	repeated until it has run for MICRO_MIN_TIME; the fastest run is reported
+*	in ns per cell, so cases and sizes compare directly. Results are summed
+*	into microSink so the compiler cannot drop the work.
+*/
+#define MICRO_MIN_TIME 0.25
+#define MICRO_MIN_RUNS 3
+
+static volatile double microSink;
+
+typedef std::chrono::steady_clock MicroClock;
+
+static double Seconds(MicroClock::time_point start)
+{
+	return std::chrono::duration<double>(MicroClock::now() - start).count();
+}
+
+//rough tilted terrain with 10% NoData, rebuilt only when the size changes
+static const CDEM& MicroDEM(int size)
+{
+	static CDEM dem;
+	if (dem.Get_NX() == size && dem.Get_NY() == size) return dem;
+	dem.freeMem();
+	dem.SetWidth(size);
+	dem.SetHeight(size);
+	dem.Allocate();
+	std::mt19937 rng(20260101u);
+	std::uniform_real_distribution<float> noise(0.0f, 1.0f);
+	for (int row = 0; row < size; row++)
+	{
+		for (int col = 0; col < size; col++)
+		{
+			float z = 0.01f * row + 0.02f * col + noise(rng) * 10.0f;
+			dem.Set_Value(row, col, noise(rng) < 0.1f ? NO_DATA_VALUE : z);
+		}
+	}
+	dem.BuildValidMask();
+	return dem;
+}
+
+//cells in a shuffled order, for the random access cases
+static const std::vector<Node>& MicroShuffle(int size)
+{
+	static std::vector<Node> cells;
+	static int cellsSize = 0;
+	if (cellsSize == size) return cells;
+	cells.resize((size_t)size * size);
+	for (int row = 0; row < size; row++)
+	{
+		for (int col = 0; col < size; col++)
+		{
+			Node& node = cells[(size_t)row * size + col];
+			node.row = row;
+			node.col = col;
+			node.spill = MicroDEM(size).asFloat(row, col);
+		}
+	}
+	std::shuffle(cells.begin(), cells.end(), std::mt19937(7u));
+	cellsSize = size;
+	return cells;
+}
+
+//Flag::SetFlag over every cell in row-major order
+static double FlagSetSequential(int size)
+{
+	Flag flag;
+	flag.Init(size, size);
+	MicroClock::time_point start = MicroClock::now();
+	for (int row = 0; row < size; row++)
+		for (int col = 0; col < size; col++)
+			flag.SetFlag(row, col);
+	double seconds = Seconds(start);
+	microSink = microSink + flag.flagArray[0];
+	return seconds;
+}
+
+//Flag::SetFlag at shuffled cells
+static double FlagSetRandom(int size)
+{
+	const std::vector<Node>& cells = MicroShuffle(size);
+	Flag flag;
+	flag.Init(size, size);
+	MicroClock::time_point start = MicroClock::now();
+	for (size_t i = 0; i < cells.size(); i++)
+		flag.SetFlag(cells[i].row, cells[i].col);
+	double seconds = Seconds(start);
+	microSink = microSink + flag.flagArray[0];
+	return seconds;
+}
+
+//Flag::IsProcessedDirect of the 8 neighbours of every interior cell, the
+//probe pattern of the engines' interior path
+static double FlagProbeNeighbours(int size)
+{
+	Flag flag;
+	flag.Init(size, size);
+	for (int row = 0; row < size; row += 3)
+		for (int col = 0; col < size; col++)
+			flag.SetFlag(row, col);
+	long long hits = 0;
+	MicroClock::time_point start = MicroClock::now();
+	for (int row = 1; row < size - 1; row++)
+		for (int col = 1; col < size - 1; col++)
+			for (int i = 0; i < 8; i++)
+				hits += flag.IsProcessedDirect(Get_rowTo<D8>(i, row), Get_colTo<D8>(i, col)) != 0;
+	double seconds = Seconds(start);
+	microSink = microSink + hits;
+	return seconds;
+}
+
+//CDEM::asFloat of the 8 neighbours of every interior cell
+static double DemGatherNeighbours(int size)
+{
+	const CDEM& dem = MicroDEM(size);
+	float sum = 0;
+	MicroClock::time_point start = MicroClock::now();
+	for (int row = 1; row < size - 1; row++)
+		for (int col = 1; col < size - 1; col++)
+			for (int i = 0; i < 8; i++)
+				sum += dem.asFloat(Get_rowTo<D8>(i, row), Get_colTo<D8>(i, col));
+	double seconds = Seconds(start);
+	microSink = microSink + sum;
+	return seconds;
+}
+
+//CDEM::is_NoData of every cell
+static double DemIsNoData(int size)
+{
+	CDEM& dem = const_cast<CDEM&>(MicroDEM(size));
+	long long noData = 0;
+	MicroClock::time_point start = MicroClock::now();
+	for (int row = 0; row < size; row++)
+		for (int col = 0; col < size; col++)
+			noData += dem.is_NoData(row, col);
+	double seconds = Seconds(start);
+	microSink = microSink + noData;
+	return seconds;
+}
+
+//CDEM::is_Valid of every cell, the bit test that replaced is_NoData in the engines
+static double DemIsValid(int size)
+{
+	const CDEM& dem = MicroDEM(size);
+	long long valid = 0;
+	MicroClock::time_point start = MicroClock::now();
+	for (int row = 0; row < size; row++)
+		for (int col = 0; col < size; col++)
+			valid += dem.is_Valid(row, col);
+	double seconds = Seconds(start);
+	microSink = microSink + valid;
+	return seconds;
+}
+
+//std::priority_queue<Node>: push every cell in shuffled order, then pop them all
+static double PriorityQueuePushPop(int size)
+{
+	const std::vector<Node>& cells = MicroShuffle(size);
+	std::priority_queue<Node, std::vector<Node>, Node::Greater> queue;
+	float last = 0;
+	MicroClock::time_point start = MicroClock::now();
+	for (size_t i = 0; i < cells.size(); i++) queue.push(cells[i]);
+	while (!queue.empty())
+	{
+		last = queue.top().spill;
+		queue.pop();
+	}
+	double seconds = Seconds(start);
+	microSink = microSink + last;
+	return seconds;
+}
+
+//std::queue<Node> holding about one row of cells: one push and one pop per
+//cell, as the depression and trace queues churn
+static double QueueChurn(int size)
+{
+	const std::vector<Node>& cells = MicroShuffle(size);
+	std::queue<Node> queue;
+	for (int i = 0; i < size; i++) queue.push(cells[i]);
+	float sum = 0;
+	MicroClock::time_point start = MicroClock::now();
+	for (size_t i = size; i < cells.size(); i++)
+	{
+		queue.push(cells[i]);
+		sum += queue.front().spill;
+		queue.pop();
+	}
+	double seconds = Seconds(start);
+	microSink = microSink + sum;
+	return seconds;
+}
+
+//calculateStatistics over the whole DEM
+static double Statistics(int size)
+{
+	const CDEM& dem = MicroDEM(size);
+	double min, max, mean, stdDev;
+	MicroClock::time_point start = MicroClock::now();
+	calculateStatistics(dem, &min, &max, &mean, &stdDev);
+	double seconds = Seconds(start);
+	microSink = microSink + mean;
+	return seconds;
+}
+
+struct MicroCase
+{
+	const char* name;
+	double (*run)(int size);
+};
+
+static const MicroCase microCases[] = {
+	{ "flag_set_sequential", FlagSetSequential },
+	{ "flag_set_random", FlagSetRandom },
+	{ "flag_probe_neighbours", FlagProbeNeighbours },
+	{ "dem_gather_neighbours", DemGatherNeighbours },
+	{ "dem_is_nodata", DemIsNoData },
+	{ "dem_is_valid", DemIsValid },
+	{ "priority_queue_push_pop", PriorityQueuePushPop },
+	{ "queue_churn", QueueChurn },
+	{ "statistics", Statistics },
+};
+
+//runs every case whose name contains filter (NULL or "" runs all) on each
+//of the sizeCount raster sizes
+void BenchmarkPrimitives(const int* sizes, int sizeCount, const char* filter)
+{
+	cout << left << setw(26) << "case" << right << setw(8) << "size"
+		<< setw(12) << "ns/cell" << setw(12) << "Mcells/s" << setw(7) << "runs" << endl;
+	for (size_t c = 0; c < sizeof(microCases) / sizeof(microCases[0]); c++)
+	{
+		const MicroCase& micro = microCases[c];
+		if (filter != NULL && filter[0] != '\0' && strstr(micro.name, filter) == NULL) continue;
+		for (int s = 0; s < sizeCount; s++)
+		{
+			int size = sizes[s];
+			double best = micro.run(size);
+			double total = best;
+			int runs = 1;
+			while (runs < MICRO_MIN_RUNS || total < MICRO_MIN_TIME)
+			{
+				double seconds = micro.run(size);
+				best = std::min(best, seconds);
+				total += seconds;
+				runs++;
+			}
+			double cells = (double)size * size;
+			cout << left << setw(26) << micro.name << right << setw(8) << size
+				<< fixed << setprecision(2) << setw(12) << best * 1e9 / cells
+				<< setw(12) << cells / best / 1e6 << setw(7) << runs << endl;
+		}
+	}
+}
@@ -0,0 +1,150 @@
+#include "progress.h"
+#include <iostream>
+#include <stdio.h>
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+ProgressSink::ProgressSink()
+{
+	total = 0;
+	interval = 4096;
+	nextReport = interval;
+	lastPercent = -1;
+	status = PROGRESS_RUNNING;
+	console = true;
+	jsonFd = -1;
+	hasDeadline = false;
+	cancelToken = NULL;
+	timeStart = std::chrono::steady_clock::now();
+}
+
+//total is the number of valid cells; also restarts the clock
+void ProgressSink::SetTotal(long long total)
+{
+	this->total = total;
+	//report roughly every 1% but keep the cancellation latency bounded
+	interval = total / 100;
+	if (interval < 4096) interval = 4096;
+	if (interval > (1 << 20)) interval = 1 << 20;
+	nextReport = interval;
+	lastPercent = -1;
+	timeStart = std::chrono::steady_clock::now();
+}
+
+void ProgressSink::SetInterval(long long interval)
+{
+	this->interval = interval > 0 ? interval : 1;
+	nextReport = this->interval;
+}
+
+void ProgressSink::SetCancelToken(const std::atomic<bool>* token)
+{
+	cancelToken = token;
+}
+
+void ProgressSink::SetDeadline(std::chrono::steady_clock::time_point deadline)
+{
+	this->deadline = deadline;
+	hasDeadline = true;
+}
+
+void ProgressSink::SetTimeout(double seconds)
+{
+	SetDeadline(std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+}
+
+void ProgressSink::SetConsole(bool enable)
+{
+	console = enable;
+}
+
+//emit one JSON object per line to fd, -1 disables it
+void ProgressSink::SetJsonFd(int fd)
+{
+	jsonFd = fd;
+}
+
+//slow path of Poll(), returns false if the fill must stop
+bool ProgressSink::Report(long long done)
+{
+	if (status != PROGRESS_RUNNING) return false;
+
+	if (cancelToken != NULL && cancelToken->load(std::memory_order_relaxed))
+		status = PROGRESS_CANCELLED;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (status == PROGRESS_RUNNING && hasDeadline && now >= deadline)
+		status = PROGRESS_DEADLINE;
+
+	int percent = 0;
+	if (total > 0)
+	{
+		percent = (int)(done * 100 / total);
+		if (percent > 100) percent = 100;
+	}
+	double elapsed = std::chrono::duration<double>(now - timeStart).count();
+	OnProgress(done, percent, elapsed);
+	lastPercent = percent;
+
+	if (status != PROGRESS_RUNNING)
+	{
+		//every later Poll() falls through to here and fails at once
+		nextReport = 0;
+		return false;
+	}
+	nextReport = done + interval;
+	return true;
+}
+
+//final report once the engine leaves its main loop
+void ProgressSink::Finish(long long done)
+{
+	if (jsonFd < 0) return;
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - timeStart).count();
+	char line[256];
+	int n = snprintf(line, sizeof(line),
+		"{\"done\":%lld,\"total\":%lld,\"elapsed\":%.3f,\"status\":\"%s\",\"finished\":true}\n",
+		done, total, elapsed, status == PROGRESS_RUNNING ? "completed" : GetStatusText());
+	if (n > 0) write(jsonFd, line, n);
+}
+
+bool ProgressSink::Stopped() const
+{
+	return status != PROGRESS_RUNNING;
+}
+
+ProgressStatus ProgressSink::GetStatus() const
+{
+	return status;
+}
+
+const char* ProgressSink::GetStatusText() const
+{
+	switch (status)
+	{
+	case PROGRESS_CANCELLED: return "cancelled";
+	case PROGRESS_DEADLINE: return "deadline";
+	default: return "running";
+	}
+}
+
+void ProgressSink::OnProgress(long long done, int percent, double elapsed)
+{
+	//the console keeps the old 5% steps
+	if (console && percent / 5 != lastPercent / 5)
+	{
+		std::cout << "Progress:" << percent / 5 * 5 << "%\r" << std::flush;
+	}
+	if (jsonFd >= 0)
+	{
+		char line[256];
+		int n = snprintf(line, sizeof(line),
+			"{\"done\":%lld,\"total\":%lld,\"percent\":%d,\"elapsed\":%.3f,\"status\":\"%s\"}\n",
+			done, total, percent, elapsed, GetStatusText());
+		if (n > 0) write(jsonFd, line, n);
+	}
+}
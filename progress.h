@@ -0,0 +1,61 @@
+#ifndef PROGRESS_HEAD_H
+#define PROGRESS_HEAD_H
+
+#include <atomic>
+#include <chrono>
+
+enum ProgressStatus
+{
+	PROGRESS_RUNNING = 0,
+	PROGRESS_CANCELLED,
+	PROGRESS_DEADLINE
+};
+
+/*
+*	Progress, cancellation and deadline sink shared by the fill engines.
+*	The engines call Poll() with the number of processed cells; the call
+*	is a single compare until the next report threshold is reached, so it
+*	can stay in the hot loops. Every report checks the cancellation token
+*	and the deadline and Poll() returns false once the fill has to stop.
+*	Subclass and override OnProgress() to plug in another output.
+*/
+class ProgressSink
+{
+protected:
+	long long total;
+	long long nextReport;
+	long long interval;
+	int lastPercent;
+	ProgressStatus status;
+	bool console;
+	int jsonFd;
+	bool hasDeadline;
+	std::chrono::steady_clock::time_point deadline;
+	std::chrono::steady_clock::time_point timeStart;
+	const std::atomic<bool>* cancelToken;
+public:
+	ProgressSink();
+	virtual ~ProgressSink() {}
+
+	void SetTotal(long long total);
+	void SetInterval(long long interval);
+	void SetCancelToken(const std::atomic<bool>* token);
+	void SetDeadline(std::chrono::steady_clock::time_point deadline);
+	void SetTimeout(double seconds);
+	void SetConsole(bool enable);
+	void SetJsonFd(int fd);
+
+	inline bool Poll(long long done)
+	{
+		return done < nextReport || Report(done);
+	}
+	bool Report(long long done);
+	void Finish(long long done);
+	bool Stopped() const;
+	ProgressStatus GetStatus() const;
+	const char* GetStatusText() const;
+protected:
+	virtual void OnProgress(long long done, int percent, double elapsed);
+};
+
+#endif
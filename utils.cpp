@@ -1,7 +1,30 @@
 #include "utils.h"
 #include "gdal_priv.h"
 #include "dem.h"
+#include "PhaseTrace.h"
 #include <string>
+#include <vector>
+#include <thread>
+#include <math.h>
+
+//move a whole band in strips of about 16M cells: each call stays far below
+//2^31 buffer elements, so rasters larger than that are read and written
+//correctly also by GDAL builds with 32-bit buffer arithmetic
+static CPLErr RasterIOInStrips(GDALRasterBand* poBand, GDALRWFlag rwFlag, int width, int height, void* pData, GDALDataType type,
+	int xOff = 0, int yOff = 0)
+{
+	size_t rowBytes = (size_t)width * (GDALGetDataTypeSize(type) / 8);
+	int stripRows = std::max(1, (1 << 24) / std::max(width, 1));
+	for (int row = 0; row < height; row += stripRows)
+	{
+		int rowCount = std::min(stripRows, height - row);
+		PhaseSpan span("strip");
+		CPLErr err = poBand->RasterIO(rwFlag, xOff, yOff + row, width, rowCount,
+			(char*)pData + (size_t)row * rowBytes, width, rowCount, type, 0, 0);
+		if (err != CE_None) return err;
+	}
+	return CE_None;
+}
 
 //create a new GeoTIFF file
 //һڴһGeoTIFFļ
@@ -10,6 +33,7 @@
 bool  CreateGeoTIFF(const char* path, int height, int width, void* pData, GDALDataType type, double* geoTransformArray6Eles,
 	double* min, double* max, double* mean, double* stdDev, double nodatavalue)
 {
+	PhaseSpan span("write");
 	//GDALݼָ룬עGDAL
 	//ѡȷļUTF-8루ͨڴUTF-8ļ·
 	GDALDataset* poDataset;
@@ -39,18 +63,239 @@ bool  CreateGeoTIFF(const char* path, int height, int width, void* pData, GDALDa
 		poBand->SetStatistics(*min, *max, *mean, *stdDev);
 	}
 	//д벨
-	poBand->RasterIO(GF_Write, 0, 0, width, height,
-		pData, width, height, type, 0, 0);
+	RasterIOInStrips(poBand, GF_Write, width, height, pData, type);
 
 	//رݼ
 	GDALClose((GDALDatasetH)poDataset);
 
 	return true;
 }
+//write a float CDEM, converting tiled or block storage back to rows
+bool CreateGeoTIFF(const char* path, const CDEM& dem, double* geoTransformArray6Eles,
+	double* min, double* max, double* mean, double* stdDev, double nodatavalue)
+{
+	if (dem.IsRowMajor())
+	{
+		return CreateGeoTIFF(path, dem.Get_NY(), dem.Get_NX(), (void*)dem.getDEMdata(), GDT_Float32,
+			geoTransformArray6Eles, min, max, mean, stdDev, nodatavalue);
+	}
+	PhaseSpan span("write");
+	int width = dem.Get_NX();
+	int height = dem.Get_NY();
+	GDALDataset* poDataset = CreateGeoTIFFDataset(path, height, width, GDT_Float32, geoTransformArray6Eles, nodatavalue);
+	if (poDataset == NULL) return false;
+	GDALRasterBand* poBand = poDataset->GetRasterBand(1);
+	if (min != NULL && max != NULL && mean != NULL && stdDev != NULL)
+	{
+		poBand->SetStatistics(*min, *max, *mean, *stdDev);
+	}
+	int stripRows = dem.StripRows();
+	std::vector<float> strip((size_t)stripRows * width);
+	for (int row = 0; row < height; row += stripRows)
+	{
+		int rowCount = std::min(stripRows, height - row);
+		PhaseSpan stripSpan("strip");
+		dem.GetRows(row, rowCount, &strip[0]);
+		poBand->RasterIO(GF_Write, 0, row, width, rowCount,
+			(void*)&strip[0], width, rowCount, GDT_Float32, 0, 0);
+	}
+	GDALClose((GDALDatasetH)poDataset);
+	return true;
+}
+
+GDALDataset* CreateGeoTIFFDataset(const char* path, int height, int width, GDALDataType type,
+	double* geoTransformArray6Eles, double nodatavalue)
+{
+	GDALAllRegister();
+	CPLSetConfigOption("GDAL_FILENAME_IS_UTF8", "NO");
+	GDALDriver* poDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	GDALDataset* poDataset = poDriver->Create(path, width, height, 1, type, NULL);
+	if (poDataset == NULL) return NULL;
+	if (geoTransformArray6Eles != NULL)
+		poDataset->SetGeoTransform(geoTransformArray6Eles);
+	poDataset->GetRasterBand(1)->SetNoDataValue(nodatavalue);
+	return poDataset;
+}
+
+static int readThreads = 1;
+
+void SetReadThreads(int threads)
+{
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	readThreads = std::max(threads, 1);
+}
+
+int GetReadThreads()
+{
+	return readThreads;
+}
+
+//windows of whole block rows handed out to the read workers
+struct ReadWindows
+{
+	const char* path;
+	//the band window read, the DEM's origin in the band
+	int xOff, yOff;
+	int width, height;
+	//windows start on band rows that are multiples of windowRows; lead is
+	//yOff % windowRows, the rows of the first window above the DEM
+	int windowRows;
+	int lead;
+	float* data;
+	bool hasNoData;
+	float fileNoData;
+	std::atomic<int> next;
+	std::atomic<bool> failed;
+};
+
+//reads and normalises windows until none is left; poDataset is the
+//worker's own handle, so GDAL decodes on every worker at once
+static void ReadWindowsOn(GDALDataset* poDataset, ReadWindows& windows)
+{
+	GDALRasterBand* poBand = poDataset->GetRasterBand(1);
+	int count = (windows.lead + windows.height + windows.windowRows - 1) / windows.windowRows;
+	int window;
+	while (!windows.failed.load() && (window = windows.next++) < count)
+	{
+		int row = std::max(window * windows.windowRows - windows.lead, 0);
+		int rowCount = std::min((window + 1) * windows.windowRows - windows.lead, windows.height) - row;
+		float* rows = windows.data + (size_t)row * windows.width;
+		PhaseSpan stripSpan("strip");
+		if (poBand->RasterIO(GF_Read, windows.xOff, windows.yOff + row, windows.width, rowCount,
+			(void*)rows, windows.width, rowCount, GDT_Float32, 0, 0) != CE_None)
+		{
+			windows.failed = true;
+			return;
+		}
+		CDEM::NormalizeNoData(rows, (size_t)rowCount * windows.width, windows.hasNoData, windows.fileNoData);
+	}
+}
+
+static void ReadWorker(ReadWindows* windows, int id)
+{
+	std::string name = "read worker " + std::to_string(id);
+	SetPhaseThreadName(name.c_str());
+	GDALDataset* poDataset = (GDALDataset*)GDALOpen(windows->path, GA_ReadOnly);
+	if (poDataset == NULL)
+	{
+		windows->failed = true;
+		return;
+	}
+	ReadWindowsOn(poDataset, *windows);
+	GDALClose((GDALDatasetH)poDataset);
+}
+
+/*
+*	Parallel read of a row-major DEM, NoData normalised. The band is cut into
+*	windows of whole block rows (GetBlockSize), at least 1M cells each, so no
+*	block is decoded by two workers. The windows are aligned on the band, not
+*	on yOff, so the first and last may be short. The calling thread reads on
+*	poDataset, the others each open their own handle. Windows land straight
+*	in data.
+*/
+static bool ReadRowsParallel(const char* path, GDALDataset* poDataset, float* data, int xOff, int yOff, int width, int height,
+	bool hasNoData, float fileNoData, int threads)
+{
+	int blockX, blockY;
+	poDataset->GetRasterBand(1)->GetBlockSize(&blockX, &blockY);
+	blockY = std::max(blockY, 1);
+	int blockRows = std::max(1, (int)(((size_t)1 << 20) / ((size_t)width * blockY)));
+	ReadWindows windows;
+	windows.path = path;
+	windows.xOff = xOff;
+	windows.yOff = yOff;
+	windows.width = width;
+	windows.height = height;
+	windows.windowRows = blockRows * blockY;
+	windows.lead = yOff % windows.windowRows;
+	windows.data = data;
+	windows.hasNoData = hasNoData;
+	windows.fileNoData = fileNoData;
+	windows.next = 0;
+	windows.failed = false;
+	int count = (windows.lead + height + windows.windowRows - 1) / windows.windowRows;
+	threads = std::min(threads, count);
+
+	std::vector<std::thread> pool;
+	for (int t = 1; t < threads; t++)
+	{
+		pool.push_back(std::thread(ReadWorker, &windows, t));
+	}
+	ReadWindowsOn(poDataset, windows);
+	for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+	return !windows.failed.load();
+}
+
+static RegionOfInterest regionOfInterest;
+static bool hasRegionOfInterest = false;
+
+void SetRegionOfInterest(const RegionOfInterest* roi)
+{
+	hasRegionOfInterest = roi != NULL;
+	if (roi != NULL) regionOfInterest = *roi;
+}
+
+const RegionOfInterest* GetRegionOfInterest()
+{
+	return hasRegionOfInterest ? &regionOfInterest : NULL;
+}
+
+//the pixel window of roi in a bandWidth x bandHeight band, halo included;
+//false if it misses the band
+static bool ResolveRegion(const RegionOfInterest& roi, const double* geoTransform, int bandWidth, int bandHeight,
+	int& col, int& row, int& width, int& height)
+{
+	long long colEnd, rowEnd;
+	if (roi.geographic)
+	{
+		//invert the affine geotransform at the four corners of the box
+		double det = geoTransform[1] * geoTransform[5] - geoTransform[2] * geoTransform[4];
+		if (det == 0) return false;
+		double xs[2] = { roi.x0, roi.x1 };
+		double ys[2] = { roi.y0, roi.y1 };
+		double minCol = 0, maxCol = 0, minRow = 0, maxRow = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			double dx = xs[i & 1] - geoTransform[0];
+			double dy = ys[i >> 1] - geoTransform[3];
+			double c = (geoTransform[5] * dx - geoTransform[2] * dy) / det;
+			double r = (geoTransform[1] * dy - geoTransform[4] * dx) / det;
+			if (i == 0 || c < minCol) minCol = c;
+			if (i == 0 || c > maxCol) maxCol = c;
+			if (i == 0 || r < minRow) minRow = r;
+			if (i == 0 || r > maxRow) maxRow = r;
+		}
+		//clamp before the casts; the clip below does the rest
+		minCol = std::max(minCol, -1.0 - roi.halo);
+		minRow = std::max(minRow, -1.0 - roi.halo);
+		maxCol = std::min(maxCol, (double)bandWidth + 1 + roi.halo);
+		maxRow = std::min(maxRow, (double)bandHeight + 1 + roi.halo);
+		col = (int)floor(minCol);
+		row = (int)floor(minRow);
+		colEnd = (long long)ceil(maxCol);
+		rowEnd = (long long)ceil(maxRow);
+	}
+	else
+	{
+		col = roi.col;
+		row = roi.row;
+		colEnd = (long long)roi.col + roi.width;
+		rowEnd = (long long)roi.row + roi.height;
+	}
+	colEnd = std::min(colEnd + roi.halo, (long long)bandWidth);
+	rowEnd = std::min(rowEnd + roi.halo, (long long)bandHeight);
+	col = std::max(col - roi.halo, 0);
+	row = std::max(row - roi.halo, 0);
+	width = (int)std::max(colEnd - col, 0LL);
+	height = (int)std::max(rowEnd - row, 0LL);
+	return width > 0 && height > 0;
+}
+
 //read a DEM GeoTIFF file 
 //һڶȡGeoTIFFļļ·͡DEMú͵任
 bool readTIFF(const char* path, GDALDataType type, CDEM& dem, double* geoTransformArray6Eles)
 {
+	PhaseSpan span("read");
 	//GDALݼָ룬עѡGeoTIFFļ
 	GDALDataset* poDataset;
 	GDALAllRegister();
@@ -82,16 +327,94 @@ bool readTIFF(const char* path, GDALDataType type, CDEM& dem, double* geoTransfo
 	memset(geoTransformArray6Eles, 0, 6);
 	poDataset->GetGeoTransform(geoTransformArray6Eles);
 
+	//the band window to read, all of it without a region of interest
+	int xOff = 0, yOff = 0;
+	int width = poBand->GetXSize();
+	int height = poBand->GetYSize();
+	if (hasRegionOfInterest)
+	{
+		if (!ResolveRegion(regionOfInterest, geoTransformArray6Eles, poBand->GetXSize(), poBand->GetYSize(),
+			xOff, yOff, width, height))
+		{
+			printf("The region of interest lies outside the DEM\n");
+			GDALClose((GDALDatasetH)poDataset);
+			return false;
+		}
+		printf("Region of interest: columns %d-%d, rows %d-%d of %d x %d\n",
+			xOff, xOff + width - 1, yOff, yOff + height - 1, poBand->GetXSize(), poBand->GetYSize());
+		//move the origin to the window's corner
+		double* gt = geoTransformArray6Eles;
+		gt[0] += xOff * gt[1] + yOff * gt[2];
+		gt[3] += xOff * gt[4] + yOff * gt[5];
+	}
+
 	//DEMĿȺ͸߶ȡ
-	dem.SetWidth(poBand->GetXSize());
-	dem.SetHeight(poBand->GetYSize());
+	dem.SetWidth(width);
+	dem.SetHeight(height);
+
+	//honour the band's own nodata value (e.g. NaN or -32768): map it onto
+	//NO_DATA_VALUE and precompute the validity mask used by the engines
+	int hasNoData = 0;
+	double fileNoData = poBand->GetNoDataValue(&hasNoData);
 
 	//ڴDEM
-	if (!dem.Allocate()) return false;
+	//no NoData prefill: RasterIO overwrites every cell
+	if (!dem.Allocate(false))
+	{
+		GDALClose((GDALDatasetH)poDataset);
+		return false;
+	}
 
 	//ӲζȡݵDEM
-	poBand->RasterIO(GF_Read, 0, 0, dem.Get_NX(), dem.Get_NY(),
-		(void*)dem.getDEMdata(), dem.Get_NX(), dem.Get_NY(), dataType, 0, 0);
+	if (!dem.IsRowMajor())
+	{
+		//read one strip of tiles or blocks at a time, normalise it and
+		//scatter it into the DEM storage
+		int stripRows = dem.StripRows();
+		std::vector<float> strip((size_t)stripRows * dem.Get_NX());
+		for (int row = 0; row < dem.Get_NY(); row += stripRows)
+		{
+			int rowCount = std::min(stripRows, dem.Get_NY() - row);
+			PhaseSpan stripSpan("strip");
+			if (poBand->RasterIO(GF_Read, xOff, yOff + row, dem.Get_NX(), rowCount,
+				(void*)&strip[0], dem.Get_NX(), rowCount, dataType, 0, 0) != CE_None)
+			{
+				GDALClose((GDALDatasetH)poDataset);
+				return false;
+			}
+			PhaseSpan scanSpan("nodata scan");
+			CDEM::NormalizeNoData(&strip[0], (size_t)rowCount * dem.Get_NX(), hasNoData != 0, (float)fileNoData);
+			scanSpan.End();
+			dem.SetRows(row, rowCount, &strip[0]);
+		}
+	}
+	else if (readThreads > 1)
+	{
+		//the NoData scan runs in the workers, window by window
+		if (!ReadRowsParallel(path, poDataset, dem.getDEMdata(), xOff, yOff, dem.Get_NX(), dem.Get_NY(),
+			hasNoData != 0, (float)fileNoData, readThreads))
+		{
+			GDALClose((GDALDatasetH)poDataset);
+			return false;
+		}
+	}
+	else
+	{
+		if (RasterIOInStrips(poBand, GF_Read, dem.Get_NX(), dem.Get_NY(), (void*)dem.getDEMdata(), dataType, xOff, yOff) != CE_None)
+		{
+			GDALClose((GDALDatasetH)poDataset);
+			return false;
+		}
+		PhaseSpan scanSpan("nodata scan");
+		dem.NormalizeNoData(hasNoData != 0, (float)fileNoData);
+	}
+	PhaseSpan maskSpan("validity mask");
+	if (!dem.BuildValidMask())
+	{
+		GDALClose((GDALDatasetH)poDataset);
+		return false;
+	}
+	maskSpan.End();
 
 	//رݼسɹ־
 	GDALClose((GDALDatasetH)poDataset);
@@ -108,23 +431,23 @@ int	ix[8] = { 0, 1, 1, 1, 0,-1,-1,-1 };
 int	iy[8] = { 1, 1, 0,-1,-1,-1, 0, 1 };
 
 //Ϊ޷ֵַ
-void setNoData(unsigned char* data, int length, unsigned char noDataValue)
+void setNoData(unsigned char* data, size_t length, unsigned char noDataValue)
 {
 	if (data == NULL || length == 0)
 	{
 		return;
 	}
 
-	for (int i = 0; i < length; i++)
+	for (size_t i = 0; i < length; i++)
 	{
 		data[i] = noDataValue;
 	}
 }
 
 //Ϊֵ
-void setNoData(float* data, int length, float noDataValue)
+void setNoData(float* data, size_t length, float noDataValue)
 {
-	for (int i = 0; i < length; i++)
+	for (size_t i = 0; i < length; i++)
 	{
 		data[i] = noDataValue;
 	}
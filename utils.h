@@ -4,7 +4,11 @@
 #include "gdal_priv.h"
 #include <queue>
 #include <algorithm>
+#include <new>
+#include <atomic>
 #include "dem.h"
+#include "BlockCache.h"
+#include "Neighbourhood.h"
 
 
 void calculateStatistics(const CDEM& dem, double* min, double* max, double* mean, double* stdDev);
@@ -18,13 +22,46 @@ inline int Get_rowTo(int dir, int row)
 inline int Get_colTo(int dir, int col) {
 	return(col + iy[dir]);
 }
-void setNoData(unsigned char* data, int length, unsigned char noDataValue);
-void setNoData(float* data, int length, float noDataValue);
-void setFlag(int index, unsigned char* flagArray);
-bool isProcessed(int index, const unsigned char* flagArray);
+void setNoData(unsigned char* data, size_t length, unsigned char noDataValue);
+void setNoData(float* data, size_t length, float noDataValue);
+void setFlag(size_t index, unsigned char* flagArray);
+bool isProcessed(size_t index, const unsigned char* flagArray);
 bool  CreateGeoTIFF(const char* path, int height, int width, void* pData, GDALDataType type, double* geoTransformArray6Eles,
 	double* min, double* max, double* mean, double* stdDev, double nodatavalue);
+bool CreateGeoTIFF(const char* path, const CDEM& dem, double* geoTransformArray6Eles,
+	double* min, double* max, double* mean, double* stdDev, double nodatavalue);
+//one-band GeoTIFF to be filled strip by strip with RasterIO; GDALClose it
+GDALDataset* CreateGeoTIFFDataset(const char* path, int height, int width, GDALDataType type,
+	double* geoTransformArray6Eles, double nodatavalue);
 bool readTIFF(const char* path, GDALDataType type, CDEM& dem, double* geoTransformArray6Eles);
+//a window of the band for readTIFF to read instead of the whole band; the
+//grid edge of the window is then the outlet of every engine
+struct RegionOfInterest
+{
+	//false: the pixel window col, row, width x height; true: the box
+	//between the corners (x0, y0) and (x1, y1) in the coordinates of the
+	//geotransform, widened to whole cells
+	bool geographic;
+	int col, row, width, height;
+	double x0, y0, x1, y1;
+	//cells added on every side, clipped to the band
+	int halo;
+	RegionOfInterest()
+	{
+		geographic = false;
+		col = row = width = height = 0;
+		x0 = y0 = x1 = y1 = 0;
+		halo = 0;
+	}
+};
+//the window readTIFF reads from now on, with the geotransform moved to its
+//corner; NULL (the default) reads the whole band
+void SetRegionOfInterest(const RegionOfInterest* roi);
+const RegionOfInterest* GetRegionOfInterest();
+//threads readTIFF decodes a row-major DEM with, each on its own dataset
+//handle; 1 (the default) reads on the calling thread, 0 uses every hardware thread
+void SetReadThreads(int threads);
+int GetReadThreads();
 CDEM* diff(CDEM& demA, CDEM& demB);
 void CreateDiffImage(const char* demA, const char* demB, char* resultPath, GDALDataType type, double nodatavalue);
 extern const unsigned char value[8];
@@ -32,34 +69,99 @@ class Flag
 {
 public:
 	int width, height;
+	int tilesPerRow;
 	unsigned char* flagArray;
+	//set instead of flagArray for out-of-core flags
+	PagedBitGrid* pager;
 public:
+	Flag()
+	{
+		width = 0;
+		height = 0;
+		tilesPerRow = 0;
+		flagArray = NULL;
+		pager = NULL;
+	}
 	~Flag()
 	{
 		Free();
 	}
+	//clears the flags; the array is reused if it already has the right size
 	bool Init(int width, int height)
 	{
-		flagArray = NULL;
+		delete pager;
+		pager = NULL;
+		size_t length = (Cells(width, height) + 7) / 8;
+		if (flagArray != NULL && (Cells(this->width, this->height) + 7) / 8 == length)
+		{
+			memset(flagArray, 0, length);
+		}
+		else
+		{
+			Free();
+			flagArray = (unsigned char*)AllocLarge(length, true);
+		}
 		this->width = width;
 		this->height = height;
-		flagArray = new unsigned char[(width * height + 7) / 8]();
+		tilesPerRow = (width + DEM_TILE_SIZE - 1) >> DEM_TILE_SHIFT;
 		return flagArray != NULL;
 	}
+	//out-of-core flags for DEM_STORAGE_PAGED, paged through a scratch file
+	bool InitPaged(int width, int height, int cacheBlocks, const std::string& scratchPath)
+	{
+		Free();
+		this->width = width;
+		this->height = height;
+		pager = new (std::nothrow) PagedBitGrid();
+		return pager != NULL && pager->Init(width, height, cacheBlocks, scratchPath);
+	}
+	//bits needed for the compiled layout, including tile padding
+	static size_t Cells(int width, int height)
+	{
+#ifdef DEM_TILED_LAYOUT
+		size_t tilesPerRow = (width + DEM_TILE_SIZE - 1) >> DEM_TILE_SHIFT;
+		size_t tilesPerCol = (height + DEM_TILE_SIZE - 1) >> DEM_TILE_SHIFT;
+		return (tilesPerRow * tilesPerCol) << (2 * DEM_TILE_SHIFT);
+#else
+		return (size_t)width * height;
+#endif
+	}
+	//same cell order as CDEM::Index
+	size_t Index(int row, int col) const
+	{
+#ifdef DEM_TILED_LAYOUT
+		return TiledIndex(row, col, tilesPerRow);
+#else
+		return (size_t)row * width + col;
+#endif
+	}
 	void Free()
 	{
-		delete[] flagArray;
+		FreeLarge(flagArray);
 		flagArray = NULL;
+		delete pager;
+		pager = NULL;
 	}
 	void SetFlag(int row, int col)
 	{
-		int index = row * width + col;
+		if (pager != NULL)
+		{
+			pager->Set(row, col);
+			return;
+		}
+		size_t index = Index(row, col);
 		flagArray[index / 8] |= value[index % 8];
 	}
 	void SetFlags(int row, int col, Flag& flag)
 	{
-		int index = row * width + col;
-		int bIndex = index / 8;
+		if (pager != NULL)
+		{
+			SetFlag(row, col);
+			flag.SetFlag(row, col);
+			return;
+		}
+		size_t index = Index(row, col);
+		size_t bIndex = index / 8;
 		int bShift = index % 8;
 		flagArray[bIndex] |= value[bShift];
 		flag.flagArray[bIndex] |= value[bShift];
@@ -68,14 +170,35 @@ public:
 	{
 		//if the cell is outside the DEM, is is regared as processed
 		if (row < 0 || row >= height || col < 0 || col >= width) return true;
-		int index = row * width + col;
+		if (pager != NULL) return pager->Test(row, col);
+		size_t index = Index(row, col);
 		return flagArray[index / 8] & value[index % 8];
 	}
 	int IsProcessedDirect(int row, int col)
 	{
-		int index = row * width + col;
+		if (pager != NULL) return pager->Test(row, col);
+		size_t index = Index(row, col);
 		return flagArray[index / 8] & value[index % 8];
 	}
+	//Inside = true skips the bounds check, for neighbours of interior cells
+	template <bool Inside>
+	int IsProcessedAt(int row, int col)
+	{
+		return Inside ? IsProcessedDirect(row, col) : IsProcessed(row, col);
+	}
+	//atomic test-and-set for the parallel tracer (in-memory flags only);
+	//true if this call set the flag
+	bool ClaimFlag(int row, int col)
+	{
+		size_t index = Index(row, col);
+		unsigned char bit = value[index % 8];
+		return (std::atomic_ref<unsigned char>(flagArray[index / 8]).fetch_or(bit, std::memory_order_relaxed) & bit) == 0;
+	}
+	int IsProcessedAtomic(int row, int col)
+	{
+		size_t index = Index(row, col);
+		return std::atomic_ref<unsigned char>(flagArray[index / 8]).load(std::memory_order_relaxed) & value[index % 8];
+	}
 };
 
 #endif